@@ -0,0 +1,118 @@
+#ifndef ANALYSIS_RECORDS_H
+#define ANALYSIS_RECORDS_H
+
+#include "StringPool.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// What the analysis produces, shared by the visitors, the CLI outputs and
+// the library API (InputAnalyzer.h). Nothing here needs clang.
+
+enum AnalysisMode {
+    Variables,
+    Functions,
+    All,
+};
+
+inline const char *modeName(AnalysisMode mode) {
+    switch (mode) {
+    case Variables: return "vars";
+    case Functions: return "funcs";
+    case All: return "all";
+    }
+    return "";
+}
+
+struct Variable {
+    Symbol type;
+    Symbol name;
+    std::pair<int, int> pos;
+};
+
+using Data = std::vector<Variable>;
+using Strings = std::vector<std::pair<std::string, std::string>>;
+
+inline void to_json(json& j, const Variable& v) {
+    j = json{
+        {"name", v.name},
+        {"type", v.type},
+        {"pos", {v.pos.first, v.pos.second}}
+    };
+}
+
+inline void from_json(const json& j, Variable& v) {
+    j.at("name").get_to(v.name);
+    j.at("type").get_to(v.type);
+    v.pos = {j.at("pos").at(0).get<int>(), j.at("pos").at(1).get<int>()};
+}
+
+// Strings are Symbols: shared, but each record keeps its own alive.
+struct Function {
+    Symbol returnType;
+    Symbol name;
+    std::vector<std::pair<Symbol, Symbol>> parameters;
+    std::pair<int, int> startPos;
+    std::pair<int, int> endPos;
+    Symbol type;
+    std::vector<std::pair<Symbol, std::vector<Symbol>>> enumValues;
+    std::vector<std::pair<Symbol, std::vector<Symbol>>> argumentVariables;
+    // Clang USR of a definition outside the main file, which other TUs may
+    // share; empty for main-file functions.
+    Symbol usr;
+};
+
+using FunctionData = std::vector<Function>;
+
+inline void to_json(json& j, const Function &f) {
+    json parametersArray = json::array();
+    for (const auto& param : f.parameters) {
+        parametersArray.push_back({{"type", param.first}, {"title", param.second}});
+    }
+    json enumValues = json::array();
+    for(const auto& value : f.enumValues) {
+        enumValues.push_back({{"var", value.first}, {"enum", value.second}});
+    }
+    json argumentVars = json::array();
+    for(const auto& var : f.argumentVariables) {
+        argumentVars.push_back({{"var", var.first}, {"names", var.second}});
+    }
+
+    j = json{
+        {"name", f.name},
+        {"returnType", f.returnType},
+        {"parameters", parametersArray},
+        {"startPos", {f.startPos.first, f.startPos.second}},
+        {"endPos", {f.endPos.first, f.endPos.second}},
+        {"type", f.type},
+        {"enumValues", enumValues},
+        {"argumentVariables", argumentVars}
+    };
+    if (!f.usr.empty()) {
+        j["usr"] = f.usr;
+    }
+}
+
+inline void from_json(const json& j, Function &f) {
+    j.at("name").get_to(f.name);
+    j.at("returnType").get_to(f.returnType);
+    j.at("type").get_to(f.type);
+    f.startPos = {j.at("startPos").at(0).get<int>(), j.at("startPos").at(1).get<int>()};
+    f.endPos = {j.at("endPos").at(0).get<int>(), j.at("endPos").at(1).get<int>()};
+    for (const auto& param : j.at("parameters")) {
+        f.parameters.push_back({param.at("type").get<Symbol>(), param.at("title").get<Symbol>()});
+    }
+    for (const auto& value : j.at("enumValues")) {
+        f.enumValues.push_back({value.at("var").get<Symbol>(), value.at("enum").get<std::vector<Symbol>>()});
+    }
+    for (const auto& var : j.at("argumentVariables")) {
+        f.argumentVariables.push_back({var.at("var").get<Symbol>(), var.at("names").get<std::vector<Symbol>>()});
+    }
+    f.usr = j.value("usr", "");
+}
+
+#endif
@@ -0,0 +1,703 @@
+#ifndef ANALYSIS_RUNNER_H
+#define ANALYSIS_RUNNER_H
+
+#include "PreExecuteAnalyzer.h"
+#include "FunctionAnalyzer.h"
+#include "CombinedAnalyzer.h"
+#include "Preamble.h"
+#include "Prefilter.h"
+#include "ResultCache.h"
+#include "TUContext.h"
+
+#include <clang/Basic/Version.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Lex/HeaderSearchOptions.h>
+#include <clang/Tooling/ArgumentsAdjusters.h>
+#include <clang/Tooling/CompilationDatabase.h>
+#include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+struct AnalysisOptions {
+    AnalysisMode mode = Variables;
+    // Appended to every compile command, like clang-tidy's -extra-arg.
+    std::vector<std::string> extraArgs;
+    // Optional; shared by all workers.
+    ResultCache *cache = nullptr;
+    // Optional (-ast-cache): serialized ASTs, so a later run in any mode
+    // loads the TU instead of parsing it.
+    ResultCache *astCache = nullptr;
+    // Parse profile: skip function bodies the mode never inspects, drop
+    // warning analyses and typo correction, and discard diagnostics.
+    bool fastParse = false;
+    // Also time a full parse of every TU to report what fastParse saved.
+    bool measureBaseline = false;
+    // See TUContext::canonicalGlobalTypes.
+    bool canonicalGlobalTypes = false;
+    // Function signature rules; null means SignatureClassifier::builtin().
+    const SignatureClassifier *classifier = nullptr;
+    // Fill TUResult::dependencies (watch mode).
+    bool recordDependencies = false;
+    // See TUContext::presizeCaches.
+    bool presizeCaches = false;
+    // See TUContext::traversalFiles.
+    std::vector<std::string> traversalFiles;
+    // Analyze a function defined in a header only in the first TU of an
+    // analyzeAll() call to reach it. Off when per-TU results must stand on
+    // their own: watch mode re-runs single TUs, and results written to the
+    // cache are reused by later runs over a different set of TUs.
+    bool dedupFunctions = true;
+    // Set by analyzeAll() when dedupFunctions applies.
+    FunctionRegistry *functionRegistry = nullptr;
+    // Skip TUs whose tokens show they have no input sites (vars mode only).
+    bool prefilter = false;
+    // Optional (-preamble); shared by all workers.
+    Preamble *preamble = nullptr;
+    // Fill TUResult::stats (--stats, --trace).
+    bool collectStats = false;
+    // Per-TU time and memory (-tu-timeout, -tu-memory-mb).
+    BudgetLimits budget;
+    // Optional (-stdin). The result cache is bypassed when set, since it
+    // hashes files as they are on disk.
+    const VirtualFiles *virtualFiles = nullptr;
+};
+
+inline BodySkipping bodySkipping(AnalysisMode mode) {
+    // FunctionVisitor reads signatures only; the variable and test visitors
+    // only look inside functions of the main file.
+    return mode == Functions ? BodySkipping::All : BodySkipping::OutsideMainFile;
+}
+
+// Everything one translation unit produced. Each worker fills its own
+// TUResult, so nothing is shared between threads until the merge.
+struct TUResult {
+    std::string file;
+    Data variables;
+    Strings strings;
+    bool canTest = false;
+    FunctionData functions;
+    // Header-defined functions this TU reached but another TU analyzed:
+    // (index into `functions` the definition came before, USR).
+    std::vector<std::pair<size_t, std::string>> skippedFunctions;
+
+    // Not part of the serialized result: the non-system files the TU read
+    // when AnalysisOptions::recordDependencies is set, and the parse profile.
+    std::vector<std::string> dependencies;
+    TUStats stats;
+    unsigned skippedBodies = 0;
+    // Not parsed at all: the prefilter found nothing to analyze.
+    bool prefiltered = false;
+    // The parse reported errors, e.g. for a missing #include.
+    bool parseFailed = false;
+    // "timeout" or "oom" when the TU went over its budget and was
+    // abandoned; empty otherwise.
+    std::string status;
+    // With a preamble: "used", or why the TU was parsed without it.
+    std::string preamble;
+    double analysisMs = 0;
+    double baselineMs = 0;
+};
+
+inline void to_json(json& j, const TUResult& r) {
+    j = json{
+        {"variables", r.variables},
+        {"strings", r.strings},
+        {"can_test", r.canTest},
+        {"functions", r.functions}
+    };
+}
+
+inline void from_json(const json& j, TUResult& r) {
+    j.at("variables").get_to(r.variables);
+    j.at("strings").get_to(r.strings);
+    j.at("can_test").get_to(r.canTest);
+    j.at("functions").get_to(r.functions);
+}
+
+// Counts diagnostics, so failed parses are still detected, but prints none.
+class SilentDiagConsumer : public DiagnosticConsumer {
+public:
+    void HandleDiagnostic(DiagnosticsEngine::Level Level, const Diagnostic &Info) override {
+        DiagnosticConsumer::HandleDiagnostic(Level, Info);
+    }
+};
+
+inline int runTool(const tooling::CompilationDatabase &db, const std::string &file, const AnalysisOptions &options,
+                   TUContext &context, TUResult &result) {
+    // A physical file system keeps the working directory per tool instead of
+    // calling chdir() for the whole process, which would race between workers.
+    tooling::ClangTool Tool(db, {file}, std::make_shared<PCHContainerOperations>(),
+                            llvm::vfs::createPhysicalFileSystem());
+    if (options.virtualFiles) {
+        // ClangTool overlays these with an InMemoryFileSystem that wraps the
+        // buffers without copying them.
+        for (const auto &[path, contents] : *options.virtualFiles) {
+            Tool.mapVirtualFile(path, contents);
+        }
+    }
+    if (!options.extraArgs.empty()) {
+        Tool.appendArgumentsAdjuster(
+            tooling::getInsertArgumentAdjuster(options.extraArgs, tooling::ArgumentInsertPosition::END));
+    }
+
+    SilentDiagConsumer silentDiagnostics;
+    if (context.skipBodies != BodySkipping::None) {
+        Tool.appendArgumentsAdjuster(
+            tooling::getInsertArgumentAdjuster({"-w", "-fno-spell-checking"}, tooling::ArgumentInsertPosition::END));
+        Tool.setDiagnosticConsumer(&silentDiagnostics);
+    }
+    // Last, so the PCH is built for the command line the TU really gets.
+    if (context.preamble) {
+        llvm::SmallString<256> Path(file);
+        llvm::sys::fs::make_absolute(Path);
+        std::vector<tooling::CompileCommand> Commands = db.getCompileCommands(Path);
+        if (!Commands.empty()) {
+            Tool.appendArgumentsAdjuster(
+                context.preamble->adjuster(Commands.front().Directory, options.virtualFiles, context));
+        }
+    }
+
+    if (options.mode == Variables) {
+        Factory f(result.variables, result.strings, result.canTest, &context);
+        return Tool.run(&f);
+    } else if (options.mode == Functions) {
+        FunctionFactory f(result.functions, &context);
+        return Tool.run(&f);
+    } else {
+        CombinedFactory f(result.variables, result.strings, result.canTest, result.functions, &context);
+        return Tool.run(&f);
+    }
+}
+
+// What a stored AST depends on besides the commands and sources: the
+// clang that wrote it and, with -fast-parse, which bodies were skipped.
+// Without -fast-parse all modes share one AST.
+inline std::string astFlavor(const AnalysisOptions &options) {
+    std::string flavor = "ast:" + getClangFullVersion();
+    if (options.fastParse) {
+        flavor += bodySkipping(options.mode) == BodySkipping::All ? "+skip-all" : "+skip-outside-main";
+    }
+    return flavor;
+}
+
+// Runs the mode's visitors over an AST stored by -ast-cache. False when it
+// cannot be loaded, e.g. because ASTReader finds a file it was built from
+// changed.
+inline bool analyzeAst(const std::string &path, const AnalysisOptions &options, TUContext &context,
+                       TUResult &result) {
+    TUStats *stats = context.stats;
+    if (stats) {
+        stats->beginPhase("ast_load");
+    }
+    auto Operations = std::make_shared<PCHContainerOperations>();
+    SilentDiagConsumer silentDiagnostics;
+    IntrusiveRefCntPtr<DiagnosticsEngine> Diags =
+        CompilerInstance::createDiagnostics(new DiagnosticOptions, &silentDiagnostics, /*ShouldOwnClient=*/false);
+    std::unique_ptr<ASTUnit> AST =
+        ASTUnit::LoadFromASTFile(path, Operations->getRawReader(), ASTUnit::LoadEverything, Diags,
+                                 FileSystemOptions(), std::make_shared<HeaderSearchOptions>());
+    if (!AST) {
+        if (stats) {
+            stats->endPhase();
+        }
+        return false;
+    }
+
+    if (stats) {
+        stats->beginPhase("traverse");
+    }
+    ASTContext &Context = AST->getASTContext();
+    SourceManager &SM = AST->getSourceManager();
+    if (context.budget) {
+        context.budget->track(Context, &AST->getPreprocessor());
+    }
+    if (options.mode == Variables) {
+        Consumer consumer(Context, SM, result.variables, result.strings, result.canTest, &context);
+        consumer.HandleTranslationUnit(Context);
+    } else if (options.mode == Functions) {
+        FunctionConsumer consumer(Context, SM, result.functions, &context);
+        consumer.HandleTranslationUnit(Context);
+    } else {
+        CombinedConsumer consumer(Context, SM, result.variables, result.strings, result.canTest, result.functions,
+                                  &context);
+        consumer.HandleTranslationUnit(Context);
+    }
+
+    if (stats) {
+        stats->beginPhase("teardown");
+    }
+    AST.reset();
+    if (stats) {
+        stats->endPhase();
+    }
+    return true;
+}
+
+inline void clearOutputs(TUResult &result) {
+    result.variables.clear();
+    result.strings.clear();
+    result.canTest = false;
+    result.functions.clear();
+    result.skippedFunctions.clear();
+}
+
+// A TU over budget reports nothing of its own. The header functions it
+// already claimed stay, since no other TU of the run will analyze them.
+inline void abandon(TUResult &result, const char *status) {
+    result.status = status;
+    result.variables.clear();
+    result.strings.clear();
+    result.canTest = false;
+
+    FunctionData shared;
+    std::vector<size_t> positions(result.functions.size() + 1);
+    for (size_t i = 0; i < result.functions.size(); ++i) {
+        positions[i] = shared.size();
+        if (!result.functions[i].usr.empty()) {
+            shared.push_back(std::move(result.functions[i]));
+        }
+    }
+    positions[result.functions.size()] = shared.size();
+    for (auto &skipped : result.skippedFunctions) {
+        skipped.first = positions[skipped.first];
+    }
+    result.functions = std::move(shared);
+}
+
+// `index` is the TU's position in the source list, which decides the owner
+// of shared functions (FunctionRegistry).
+inline TUResult analyzeTU(const tooling::CompilationDatabase &db, const std::string &file, const AnalysisOptions &options,
+                          size_t index = 0) {
+    TUResult result;
+    result.file = file;
+
+    TUStats *stats = options.collectStats ? &result.stats : nullptr;
+    if (stats) {
+        stats->file = file;
+        stats->thread = statsThreadId();
+    }
+
+    // Functions mode reports every definition, so only vars mode can tell
+    // from the tokens that there is nothing to report.
+    if (options.prefilter && options.mode == Variables) {
+        if (stats) {
+            stats->beginPhase("prefilter");
+        }
+        llvm::SmallString<256> Path(file);
+        llvm::sys::fs::make_absolute(Path);
+        std::vector<tooling::CompileCommand> Commands = db.getCompileCommands(Path);
+        bool mayHaveInputs = Commands.empty() || LexicalPrefilter::commandMayHaveInputs(options.extraArgs) ||
+                             LexicalPrefilter::mayHaveInputs(file, options.virtualFiles);
+        for (const auto &Command : Commands) {
+            mayHaveInputs = mayHaveInputs || LexicalPrefilter::commandMayHaveInputs(Command.CommandLine);
+        }
+        if (stats) {
+            stats->endPhase();
+        }
+        if (!mayHaveInputs) {
+            result.prefiltered = true;
+            if (stats) {
+                stats->prefiltered = true;
+            }
+            if (options.recordDependencies) {
+                llvm::sys::path::remove_dots(Path, true);
+                result.dependencies.push_back(std::string(Path));
+            }
+            return result;
+        }
+    }
+
+    std::optional<std::string> cacheKey;
+    if (options.cache && !options.virtualFiles) {
+        if (stats) {
+            stats->beginPhase("cache_lookup");
+        }
+        std::string cacheMode = std::string(modeName(options.mode)) + (options.fastParse ? "+fast" : "") +
+                                (options.canonicalGlobalTypes ? "+canonical" : "") +
+                                (options.classifier ? "+rules:" + options.classifier->fingerprint() : "");
+        cacheKey = options.cache->manifestKey(db, file, cacheMode, options.extraArgs);
+        json cached;
+        std::vector<std::string> dependencies;
+        if (cacheKey && options.cache->lookup(*cacheKey, cached, &dependencies)) {
+            try {
+                cached.get_to(result);
+                if (options.recordDependencies) {
+                    result.dependencies = std::move(dependencies);
+                }
+                if (stats) {
+                    stats->cached = true;
+                    stats->endPhase();
+                }
+                return result;
+            } catch (const json::exception &) {
+                clearOutputs(result);
+            }
+        }
+    }
+
+    // Looked up only after the result cache, which is cheaper still.
+    std::optional<std::string> astKey;
+    std::optional<std::string> astPath;
+    std::vector<std::string> astDependencies;
+    if (options.astCache && !options.virtualFiles) {
+        if (stats) {
+            stats->beginPhase("ast_lookup");
+        }
+        astKey = options.astCache->manifestKey(db, file, astFlavor(options), options.extraArgs);
+        if (astKey) {
+            astPath = options.astCache->lookupFile(*astKey, ".ast", &astDependencies);
+        }
+        if (stats) {
+            stats->endPhase();
+        }
+    }
+
+    // Started here, so cache hits and lookups are never charged to it.
+    std::optional<TUBudget> budget;
+    if (options.budget.any()) {
+        budget.emplace(options.budget);
+    }
+
+    auto configure = [&](TUContext &context) {
+        context.recordDependencies = cacheKey.has_value() || astKey.has_value() || options.recordDependencies;
+        context.serializeAst = astKey.has_value();
+        if (options.fastParse) {
+            context.skipBodies = bodySkipping(options.mode);
+        }
+        context.canonicalGlobalTypes = options.canonicalGlobalTypes;
+        context.classifier = options.classifier;
+        context.presizeCaches = options.presizeCaches;
+        context.traversalFiles = options.traversalFiles;
+        // A TU that goes into the cache must list every function it defines.
+        context.functions = cacheKey ? nullptr : options.functionRegistry;
+        context.index = index;
+        context.stats = stats;
+        context.budget = budget ? &*budget : nullptr;
+    };
+
+    TUContext context;
+    configure(context);
+    if (options.preamble && astKey) {
+        // An AST built on a PCH would need that PCH to load.
+        result.preamble = "not used with -ast-cache";
+    } else if (options.preamble) {
+        if (Preamble::startsWithInclude(file, options.virtualFiles)) {
+            context.preamble = options.preamble;
+        } else {
+            result.preamble = "no leading #include";
+        }
+    }
+
+    if (stats) {
+        stats->beginPhase("driver");
+    }
+    auto start = std::chrono::steady_clock::now();
+    int status = 0;
+    bool fromAst = astPath && analyzeAst(*astPath, options, context, result);
+    if (fromAst) {
+        context.dependencies = std::move(astDependencies);
+    } else {
+        status = runTool(db, file, options, context, result);
+    }
+
+    if (context.preamble) {
+        if (context.preambleHeader.empty()) {
+            result.preamble = context.preambleError.empty() ? "no compile command" : context.preambleError;
+        } else if (status != 0) {
+            result.preamble = "parse failed on the preamble";
+        } else if (!context.preambleMatched) {
+            result.preamble = "first #include is not " + context.preamble->header();
+        } else {
+            result.preamble = "used";
+        }
+
+        // Anything but a clean parse that skipped the header is redone from
+        // source, budget permitting. The first attempt may have claimed shared
+        // functions and dropped them with its result, so this one analyzes all
+        // of its own; analyzeAll() then settles which of them it owns.
+        if (result.preamble != "used" && !context.preambleHeader.empty() && !(budget && budget->check())) {
+            clearOutputs(result);
+            context = TUContext();
+            configure(context);
+            context.functions = nullptr;
+            status = runTool(db, file, options, context, result);
+        }
+    }
+
+    result.analysisMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    result.parseFailed = status != 0;
+    result.skippedBodies = context.skippedBodies;
+    result.skippedFunctions = std::move(context.skippedFunctions);
+    if (budget && budget->outcome() != TUBudget::Within) {
+        abandon(result, budget->status());
+    }
+    if (stats) {
+        stats->preamble = result.preamble;
+        stats->endPhase();
+    }
+
+    if (options.fastParse && options.measureBaseline) {
+        TUContext baselineContext;
+        baselineContext.canonicalGlobalTypes = options.canonicalGlobalTypes;
+        baselineContext.classifier = options.classifier;
+        TUResult baseline;
+        start = std::chrono::steady_clock::now();
+        runTool(db, file, options, baselineContext, baseline);
+        result.baselineMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // A failed run may be missing a header that shows up later, which the
+    // dependency list could not capture, so only clean runs are stored.
+    if (astKey && !fromAst && status == 0 && !context.ast.empty()) {
+        if (stats) {
+            stats->beginPhase("ast_store");
+        }
+        options.astCache->storeFile(*astKey, context.dependencies, ".ast", context.ast);
+        if (stats) {
+            stats->endPhase();
+        }
+    }
+    if (cacheKey && status == 0 && result.status.empty()) {
+        if (stats) {
+            stats->beginPhase("cache_store");
+        }
+        options.cache->store(*cacheKey, context.dependencies, result);
+        if (stats) {
+            stats->endPhase();
+        }
+    }
+    if (options.recordDependencies) {
+        result.dependencies = std::move(context.dependencies);
+    }
+    return result;
+}
+
+// A TU that analyzed shared functions without claiming them (cached, or
+// parsed again without its preamble) claims them now, so that ownership is
+// the same as if it had parsed with the registry.
+inline void claimFunctions(const TUResult &result, FunctionRegistry &registry, size_t index) {
+    for (const auto &function : result.functions) {
+        if (!function.usr.empty()) {
+            registry.claim(function.usr, index);
+        }
+    }
+}
+
+// Turns the shared functions the TU analyzed but an earlier TU owns into
+// skipped entries. Called once every TU before it finished, when no claim
+// can take ownership from it any more.
+inline void releaseFunctions(TUResult &result, FunctionRegistry &registry, size_t index) {
+    FunctionData kept;
+    std::vector<std::pair<size_t, std::string>> skipped;
+    auto previous = result.skippedFunctions.begin();
+    for (size_t i = 0; i <= result.functions.size(); ++i) {
+        for (; previous != result.skippedFunctions.end() && previous->first == i; ++previous) {
+            skipped.push_back({kept.size(), std::move(previous->second)});
+        }
+        if (i == result.functions.size()) {
+            break;
+        }
+        Function &function = result.functions[i];
+        if (!function.usr.empty() && !registry.owns(function.usr, index)) {
+            skipped.push_back({kept.size(), function.usr.str()});
+        } else {
+            kept.push_back(std::move(function));
+        }
+    }
+    result.functions = std::move(kept);
+    result.skippedFunctions = std::move(skipped);
+}
+
+// Receives finished TUs in the order of the source list, one call at a time.
+using TUSink = std::function<void(size_t index, TUResult &result)>;
+
+// Runs every source on up to `jobs` threads (0 means one per core). Workers
+// pull the next unclaimed index; a finished TU is handed to `sink` as soon
+// as every TU before it has been, so output does not depend on scheduling
+// and only out-of-order results are held back. Shared functions are listed
+// by the first TU in source order that reached them.
+inline void analyzeAll(const tooling::CompilationDatabase &db, const std::vector<std::string> &files,
+                       const AnalysisOptions &runOptions, unsigned jobs, const TUSink &sink) {
+    FunctionRegistry registry;
+    AnalysisOptions options = runOptions;
+    if (options.dedupFunctions && !options.functionRegistry) {
+        options.functionRegistry = &registry;
+    }
+
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = std::min<size_t>(jobs, files.size());
+
+    FunctionRegistry *functions = options.functionRegistry;
+    auto analyzeIndex = [&](size_t i) {
+        TUResult result = analyzeTU(db, files[i], options, i);
+        if (functions) {
+            claimFunctions(result, *functions, i);
+        }
+        return result;
+    };
+    auto emit = [&](size_t i, TUResult &result) {
+        if (functions) {
+            releaseFunctions(result, *functions, i);
+        }
+        sink(i, result);
+    };
+
+    if (jobs <= 1) {
+        for (size_t i = 0; i < files.size(); ++i) {
+            TUResult result = analyzeIndex(i);
+            emit(i, result);
+        }
+        return;
+    }
+
+    std::mutex mutex;
+    std::vector<std::optional<TUResult>> pending(files.size());
+    size_t emitted = 0;
+
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < jobs; ++w) {
+        workers.emplace_back([&] {
+            for (size_t i = next++; i < files.size(); i = next++) {
+                TUResult result = analyzeIndex(i);
+                std::lock_guard<std::mutex> lock(mutex);
+                pending[i] = std::move(result);
+                while (emitted < files.size() && pending[emitted]) {
+                    emit(emitted, *pending[emitted]);
+                    pending[emitted].reset();
+                    ++emitted;
+                }
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+inline std::vector<TUResult> analyzeAll(const tooling::CompilationDatabase &db, const std::vector<std::string> &files,
+                                        const AnalysisOptions &options, unsigned jobs) {
+    std::vector<TUResult> results(files.size());
+    analyzeAll(db, files, options, jobs, [&](size_t index, TUResult &result) { results[index] = std::move(result); });
+    return results;
+}
+
+struct MergedFunction {
+    const Function *function;
+    // Every TU that defined it, in source order.
+    std::vector<std::string> files;
+};
+
+// Lists each function once, at the first TU in source order that reached
+// it, with the record of the first TU in source order that analyzed it:
+// the same TU after analyzeAll(), and for the documents of -shard runs too.
+// Main-file functions have no USR and are never merged.
+inline std::vector<MergedFunction> mergeFunctions(const std::vector<TUResult> &results) {
+    llvm::StringMap<const Function *> analyzed;
+    for (const auto &tu : results) {
+        for (const auto &function : tu.functions) {
+            if (!function.usr.empty()) {
+                analyzed.try_emplace(function.usr, &function);
+            }
+        }
+    }
+
+    std::vector<MergedFunction> merged;
+    llvm::StringMap<size_t> positions;
+    auto add = [&](llvm::StringRef usr, const Function *function, const std::string &file) {
+        if (usr.empty()) {
+            merged.push_back({function, {file}});
+            return;
+        }
+        auto it = positions.find(usr);
+        if (it != positions.end()) {
+            merged[it->second].files.push_back(file);
+            return;
+        }
+        if (const Function *owner = analyzed.lookup(usr)) {
+            positions[usr] = merged.size();
+            merged.push_back({owner, {file}});
+        }
+    };
+
+    for (const auto &tu : results) {
+        auto skipped = tu.skippedFunctions.begin();
+        for (size_t i = 0; i <= tu.functions.size(); ++i) {
+            for (; skipped != tu.skippedFunctions.end() && skipped->first == i; ++skipped) {
+                add(skipped->second, nullptr, tu.file);
+            }
+            if (i < tu.functions.size()) {
+                add(tu.functions[i].usr, &tu.functions[i], tu.file);
+            }
+        }
+    }
+    return merged;
+}
+
+// Merges per-TU shards into the document a single sequential run produces.
+// "all" mode emits the keys of both the vars and the funcs documents, and
+// any mode lists TUs abandoned over budget under "abandoned":
+// [{"file", "status": "timeout" | "oom"}].
+inline json mergeResults(const std::vector<TUResult> &results, AnalysisMode mode) {
+    json result = json::object();
+
+    if (mode == Variables || mode == All) {
+        bool canTest = false;
+        result["strings"] = json::array();
+        result["variables"] = json::array();
+        for (const auto &tu : results) {
+            for (const auto& [type, filename] : tu.strings) {
+                result["strings"].push_back({
+                    {"type", type},
+                    {"filename", filename}
+                });
+            }
+            for (const auto &variable : tu.variables) {
+                result["variables"].push_back(variable);
+            }
+            canTest = canTest || tu.canTest;
+        }
+        result["can_test"] = canTest;
+    }
+    if (mode == Functions || mode == All) {
+        json functions = json::array();
+        for (const auto &merged : mergeFunctions(results)) {
+            json function = *merged.function;
+            function["files"] = merged.files;
+            functions.push_back(std::move(function));
+        }
+        result["functions"] = functions;
+    }
+
+    // Present only when some TU went over its budget.
+    json abandoned = json::array();
+    for (const auto &tu : results) {
+        if (!tu.status.empty()) {
+            abandoned.push_back({{"file", tu.file}, {"status", tu.status}});
+        }
+    }
+    if (!abandoned.empty()) {
+        result["abandoned"] = std::move(abandoned);
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,463 @@
+#ifndef ANALYSIS_SERVER_H
+#define ANALYSIS_SERVER_H
+
+#include "AnalysisRunner.h"
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/StringMap.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+// One client of the server: stdin/stdout or an accepted socket. Responses
+// from different workers are serialized per connection, one line each.
+class Connection {
+public:
+    Connection(int inFd, int outFd, bool ownsFds) : _inFd(inFd), _outFd(outFd), _ownsFds(ownsFds) {}
+
+    ~Connection() {
+        if (_ownsFds) {
+            close(_inFd);
+        }
+    }
+
+    // Returns false once the peer closed its end.
+    bool readLine(std::string &line) {
+        while (true) {
+            size_t newline = _buffer.find('\n');
+            if (newline != std::string::npos) {
+                line = _buffer.substr(0, newline);
+                _buffer.erase(0, newline + 1);
+                return true;
+            }
+            char chunk[4096];
+            ssize_t n = read(_inFd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                if (_buffer.empty()) return false;
+                line.swap(_buffer);
+                _buffer.clear();
+                return true;
+            }
+            _buffer.append(chunk, n);
+        }
+    }
+
+    // Makes a blocked or later readLine return false.
+    void hangUp() { shutdown(_inFd, SHUT_RDWR); }
+
+    void writeLine(const json &message) {
+        std::string text = message.dump() + "\n";
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        const char *data = text.data();
+        size_t left = text.size();
+        while (left > 0) {
+            ssize_t n = write(_outFd, data, left);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) return;
+            data += n;
+            left -= n;
+        }
+    }
+
+private:
+    int _inFd;
+    int _outFd;
+    bool _ownsFds;
+    std::string _buffer;
+    std::mutex _writeMutex;
+};
+
+// Long-lived analyzer reading newline-delimited JSON requests:
+//   {"id": 1, "files": ["a.cpp"], "mode": "vars", "args": ["-std=c++17"], "build_path": "build"}
+//   {"id": 2, "type": "stats"}
+// Every request is answered with one line carrying the same "id" and either
+// "result" (the document the CLI would print), "stats" or "error".
+class AnalysisServer {
+public:
+    // `defaults` carries the command-line options (cache, parse profile, ...)
+    // that requests do not override.
+    AnalysisServer(const tooling::CompilationDatabase &defaultDb, unsigned workers, const AnalysisOptions &defaults)
+        : _defaultDb(defaultDb), _defaults(defaults),
+          _workerCount(workers ? workers : std::max(1u, std::thread::hardware_concurrency())) {}
+
+    ~AnalysisServer() {
+        stop();
+        joinReaders(true);
+    }
+
+    int serveStdio() {
+        ignoreSigpipe();
+        startWorkers();
+        readRequests(std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO, false));
+        stopWorkers();
+        return 0;
+    }
+
+    int serveSocket(const std::string &path) {
+        ignoreSigpipe();
+        int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) {
+            std::cerr << "Error creating socket" << std::endl;
+            return 1;
+        }
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path is too long: " << path << std::endl;
+            close(listenFd);
+            return 1;
+        }
+        std::copy(path.begin(), path.end(), address.sun_path);
+        unlink(path.c_str());
+
+        if (bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listenFd, 64) < 0) {
+            std::cerr << "Error listening on " << path << std::endl;
+            close(listenFd);
+            return 1;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_readersMutex);
+            if (_closing) {
+                close(listenFd);
+                return 0;
+            }
+            _listenFd = listenFd;
+        }
+        startWorkers();
+        while (true) {
+            int clientFd = accept(listenFd, nullptr, nullptr);
+            if (clientFd < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            joinReaders(false);
+
+            auto connection = std::make_shared<Connection>(clientFd, clientFd, true);
+            std::lock_guard<std::mutex> lock(_readersMutex);
+            if (_closing) {
+                break;
+            }
+            Reader &reader = _readers.emplace_back();
+            reader.connection = connection;
+            reader.thread = std::thread([this, &reader] {
+                readRequests(reader.connection);
+                reader.done = true;
+            });
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_readersMutex);
+            _closing = true;
+            _listenFd = -1;
+            for (auto &reader : _readers) {
+                reader.connection->hangUp();
+            }
+        }
+        close(listenFd);
+        joinReaders(true);
+        stopWorkers();
+        return 0;
+    }
+
+    // Makes a running serveSocket stop accepting and hang up on its
+    // clients; it returns once the workers have drained the queue. Safe to
+    // call from another thread or twice; the server must outlive
+    // serveSocket.
+    void stop() {
+        std::lock_guard<std::mutex> lock(_readersMutex);
+        _closing = true;
+        if (_listenFd >= 0) {
+            shutdown(_listenFd, SHUT_RDWR);
+        }
+        for (auto &reader : _readers) {
+            reader.connection->hangUp();
+        }
+    }
+
+    static json requestId(const json &body) {
+        return body.contains("id") ? body["id"] : json();
+    }
+
+    // Answers one analysis request on the calling thread; batch workers
+    // (BatchRunner.h) use it directly.
+    json handle(const json &body, std::string &error) {
+        AnalysisOptions options = _defaults;
+        std::string mode;
+        std::string buildPath;
+        std::vector<std::string> files;
+        try {
+            mode = body.value("mode", "vars");
+            buildPath = body.value("build_path", "");
+            files = body.value("files", std::vector<std::string>());
+            options.extraArgs = body.value("args", std::vector<std::string>());
+        } catch (const json::exception &) {
+            error = "malformed request: \"mode\" and \"build_path\" must be strings, \"files\" and \"args\" arrays of strings";
+            return json();
+        }
+
+        if (mode == "vars") {
+            options.mode = Variables;
+        } else if (mode == "funcs") {
+            options.mode = Functions;
+        } else if (mode == "all") {
+            options.mode = All;
+        } else {
+            error = "unknown mode: " + mode;
+            return json();
+        }
+        if (files.empty()) {
+            error = "no files given";
+            return json();
+        }
+
+        const tooling::CompilationDatabase *db = &_defaultDb;
+        if (!buildPath.empty()) {
+            db = compilationDatabase(buildPath, error);
+            if (!db) return json();
+        }
+
+        return mergeResults(analyzeAll(*db, files, options, 1), options.mode);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        json body;
+        std::shared_ptr<Connection> connection;
+        Clock::time_point received;
+    };
+
+    const tooling::CompilationDatabase &_defaultDb;
+    AnalysisOptions _defaults;
+    unsigned _workerCount;
+    std::vector<std::thread> _workers;
+
+    std::mutex _queueMutex;
+    std::condition_variable _queueReady;
+    std::deque<Request> _queue;
+    bool _stopping = false;
+
+    std::mutex _statsMutex;
+    size_t _inFlight = 0;
+    size_t _completed = 0;
+    size_t _failed = 0;
+    std::vector<double> _latencies;
+    size_t _dbHits = 0;
+    size_t _dbMisses = 0;
+
+    std::mutex _dbMutex;
+    llvm::StringMap<std::unique_ptr<tooling::CompilationDatabase>> _databases;
+
+    // The thread reading each socket client. Finished ones are joined as
+    // new clients arrive, the rest when serveSocket returns.
+    struct Reader {
+        std::shared_ptr<Connection> connection;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+    std::mutex _readersMutex;
+    std::list<Reader> _readers;
+    int _listenFd = -1;
+    bool _closing = false;
+
+    // Latencies kept for the percentile window in stats responses.
+    static constexpr size_t LatencyWindow = 1024;
+
+    // A client that hangs up before its response is written must fail that
+    // write, not kill the server.
+    static void ignoreSigpipe() { signal(SIGPIPE, SIG_IGN); }
+
+    void joinReaders(bool all) {
+        std::list<Reader> finished;
+        {
+            std::lock_guard<std::mutex> lock(_readersMutex);
+            for (auto it = _readers.begin(); it != _readers.end();) {
+                auto next = std::next(it);
+                if (all || it->done) {
+                    finished.splice(finished.end(), _readers, it);
+                }
+                it = next;
+            }
+        }
+        for (auto &reader : finished) {
+            reader.thread.join();
+        }
+    }
+
+    void startWorkers() {
+        for (unsigned i = 0; i < _workerCount; ++i) {
+            _workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    void stopWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+            _stopping = true;
+        }
+        _queueReady.notify_all();
+        for (auto &worker : _workers) {
+            worker.join();
+        }
+        _workers.clear();
+    }
+
+    void readRequests(std::shared_ptr<Connection> connection) {
+        std::string line;
+        while (connection->readLine(line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+            json body = json::parse(line, nullptr, false);
+            if (body.is_discarded() || !body.is_object()) {
+                connection->writeLine({{"id", nullptr}, {"error", "request is not a JSON object"}});
+                continue;
+            }
+
+            if (body.contains("type") && body["type"] == "stats") {
+                connection->writeLine({{"id", requestId(body)}, {"stats", stats()}});
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_queueMutex);
+                _queue.push_back({std::move(body), connection, Clock::now()});
+            }
+            _queueReady.notify_one();
+        }
+    }
+
+    void workerLoop() {
+        while (true) {
+            Request request;
+            {
+                std::unique_lock<std::mutex> lock(_queueMutex);
+                _queueReady.wait(lock, [this] { return _stopping || !_queue.empty(); });
+                if (_queue.empty()) return;
+                request = std::move(_queue.front());
+                _queue.pop_front();
+            }
+            {
+                std::lock_guard<std::mutex> lock(_statsMutex);
+                ++_inFlight;
+            }
+
+            json response = {{"id", requestId(request.body)}};
+            bool ok = true;
+            std::string error;
+            json result = handle(request.body, error);
+            if (error.empty()) {
+                response["result"] = std::move(result);
+            } else {
+                response["error"] = error;
+                ok = false;
+            }
+            request.connection->writeLine(response);
+
+            double latency = std::chrono::duration<double, std::milli>(Clock::now() - request.received).count();
+            std::lock_guard<std::mutex> lock(_statsMutex);
+            --_inFlight;
+            ++_completed;
+            if (!ok) ++_failed;
+            if (_latencies.size() == LatencyWindow) {
+                _latencies.erase(_latencies.begin());
+            }
+            _latencies.push_back(latency);
+        }
+    }
+
+    // Compilation databases are loaded once per build directory and reused.
+    const tooling::CompilationDatabase *compilationDatabase(const std::string &buildPath, std::string &error) {
+        std::lock_guard<std::mutex> lock(_dbMutex);
+        auto it = _databases.find(buildPath);
+        if (it != _databases.end()) {
+            std::lock_guard<std::mutex> statsLock(_statsMutex);
+            ++_dbHits;
+            return it->second.get();
+        }
+
+        std::string message;
+        auto db = tooling::CompilationDatabase::loadFromDirectory(buildPath, message);
+        {
+            std::lock_guard<std::mutex> statsLock(_statsMutex);
+            ++_dbMisses;
+        }
+        if (!db) {
+            error = "cannot load compilation database from " + buildPath + ": " + message;
+            return nullptr;
+        }
+        return (_databases[buildPath] = std::move(db)).get();
+    }
+
+    json stats() {
+        size_t queueDepth;
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+            queueDepth = _queue.size();
+        }
+
+        std::lock_guard<std::mutex> lock(_statsMutex);
+        json latency = json::object();
+        if (!_latencies.empty()) {
+            std::vector<double> sorted(_latencies);
+            std::sort(sorted.begin(), sorted.end());
+            auto percentile = [&](double p) {
+                return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+            };
+            double sum = 0;
+            for (double value : sorted) sum += value;
+            latency = {
+                {"last", _latencies.back()},
+                {"mean", sum / sorted.size()},
+                {"p50", percentile(0.50)},
+                {"p95", percentile(0.95)},
+                {"max", sorted.back()}
+            };
+        }
+
+        json cache = {
+            {"compilation_db_hits", _dbHits},
+            {"compilation_db_misses", _dbMisses}
+        };
+        if (_defaults.cache) {
+            cache["result_hits"] = _defaults.cache->hits();
+            cache["result_misses"] = _defaults.cache->misses();
+        }
+
+        return {
+            {"queue_depth", queueDepth},
+            {"in_flight", _inFlight},
+            {"completed", _completed},
+            {"failed", _failed},
+            {"latency_ms", latency},
+            {"cache", cache}
+        };
+    }
+};
+
+#endif
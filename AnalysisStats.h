@@ -0,0 +1,259 @@
+#ifndef ANALYSIS_STATS_H
+#define ANALYSIS_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include <sys/resource.h>
+
+using json = nlohmann::json;
+
+// Timestamps in trace files count from the first call.
+inline std::chrono::steady_clock::time_point statsOrigin() {
+    static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    return origin;
+}
+
+inline double threadCpuMs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+inline double processCpuMs() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+inline long peakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Small, stable ids for trace files: the first thread to ask gets 0.
+inline unsigned statsThreadId() {
+    static std::atomic<unsigned> next{0};
+    thread_local unsigned id = next++;
+    return id;
+}
+
+struct CacheCounter {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+
+    void add(const CacheCounter &other) {
+        lookups += other.lookups;
+        hits += other.hits;
+    }
+};
+
+inline void to_json(json &j, const CacheCounter &counter) {
+    j = json{
+        {"lookups", counter.lookups},
+        {"hits", counter.hits},
+        {"hit_rate", counter.lookups ? static_cast<double>(counter.hits) / counter.lookups : 0.0}
+    };
+}
+
+struct PhaseTime {
+    std::string name;
+    double startUs = 0;
+    double wallMs = 0;
+    double cpuMs = 0;
+};
+
+// Measures wall time and either the calling thread's or the whole
+// process's CPU time from construction until stop().
+class PhaseClock {
+public:
+    explicit PhaseClock(bool processCpu = false)
+        : _processCpu(processCpu), _wall(std::chrono::steady_clock::now()), _cpu(cpuNow()) {}
+
+    PhaseTime stop(std::string name) const {
+        auto now = std::chrono::steady_clock::now();
+        PhaseTime phase;
+        phase.name = std::move(name);
+        phase.startUs = std::chrono::duration<double, std::micro>(_wall - statsOrigin()).count();
+        phase.wallMs = std::chrono::duration<double, std::milli>(now - _wall).count();
+        phase.cpuMs = cpuNow() - _cpu;
+        return phase;
+    }
+
+private:
+    bool _processCpu;
+    std::chrono::steady_clock::time_point _wall;
+    double _cpu;
+
+    double cpuNow() const { return _processCpu ? processCpuMs() : threadCpuMs(); }
+};
+
+// What one TU cost. Phases are consecutive on the TU's thread, except
+// "globals_index", which runs inside "traverse":
+//   prefilter     the raw-token scan of -prefilter
+//   cache_lookup  result cache probe (with -cache-dir)
+//   driver        compile command lookup, argument adjusting, compiler setup
+//   parse         preprocessing, parsing and Sema
+//   traverse      the visitors' walk of the AST
+//   count         the extra walk that counts AST nodes for these stats
+//   teardown      end of the frontend action and AST destruction
+//   cache_store   writing the result cache entry
+struct TUStats {
+    std::string file;
+    unsigned thread = 0;
+    bool cached = false;
+    bool prefiltered = false;
+    // See TUResult::preamble.
+    std::string preamble;
+    std::vector<PhaseTime> phases;
+
+    uint64_t decls = 0;
+    uint64_t stmts = 0;
+    uint64_t callExprVisits = 0;
+    uint64_t functionDeclVisits = 0;
+    uint64_t globals = 0;
+    // Header-defined functions left to the TU that claimed them first.
+    uint64_t sharedFunctionsSkipped = 0;
+    // Header declarations at file scope the vars-mode walk never entered.
+    uint64_t topLevelDeclsSkipped = 0;
+    // VariableVisitor's per-TU caches of variable types and std::cin decls.
+    CacheCounter variableCache;
+    CacheCounter cinCache;
+
+    void beginPhase(const char *name) {
+        endPhase();
+        _open = PhaseClock();
+        _openName = name;
+    }
+
+    void endPhase() {
+        if (!_openName.empty()) {
+            phases.push_back(_open.stop(_openName));
+            _openName.clear();
+        }
+    }
+
+private:
+    PhaseClock _open;
+    std::string _openName;
+};
+
+inline json phasesJson(const std::vector<PhaseTime> &phases) {
+    json object = json::object();
+    for (const auto &phase : phases) {
+        if (!object.contains(phase.name)) {
+            object[phase.name] = {{"wall_ms", 0.0}, {"cpu_ms", 0.0}};
+        }
+        json &entry = object[phase.name];
+        entry["wall_ms"] = entry["wall_ms"].get<double>() + phase.wallMs;
+        entry["cpu_ms"] = entry["cpu_ms"].get<double>() + phase.cpuMs;
+    }
+    return object;
+}
+
+inline json countersJson(const TUStats &stats) {
+    return json{
+        {"decls", stats.decls},
+        {"stmts", stats.stmts},
+        {"visit_call_expr", stats.callExprVisits},
+        {"visit_function_decl", stats.functionDeclVisits},
+        {"globals_indexed", stats.globals},
+        {"shared_functions_skipped", stats.sharedFunctionsSkipped},
+        {"top_level_decls_skipped", stats.topLevelDeclsSkipped},
+        {"variable_cache", stats.variableCache},
+        {"cin_cache", stats.cinCache}
+    };
+}
+
+struct CacheCounts {
+    bool enabled = false;
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+// The "stats" object: process-wide phases ("analysis", "serialize"),
+// totals over all TUs, cache hit rate and one entry per TU.
+inline json statsDocument(const std::vector<TUStats> &tus, const std::vector<PhaseTime> &processPhases,
+                          const CacheCounts &cache) {
+    TUStats totals;
+    std::vector<PhaseTime> tuPhases;
+    json perTU = json::array();
+    for (const auto &tu : tus) {
+        totals.decls += tu.decls;
+        totals.stmts += tu.stmts;
+        totals.callExprVisits += tu.callExprVisits;
+        totals.functionDeclVisits += tu.functionDeclVisits;
+        totals.globals += tu.globals;
+        totals.sharedFunctionsSkipped += tu.sharedFunctionsSkipped;
+        totals.topLevelDeclsSkipped += tu.topLevelDeclsSkipped;
+        totals.variableCache.add(tu.variableCache);
+        totals.cinCache.add(tu.cinCache);
+        tuPhases.insert(tuPhases.end(), tu.phases.begin(), tu.phases.end());
+
+        json entry = countersJson(tu);
+        entry["file"] = tu.file;
+        entry["thread"] = tu.thread;
+        entry["cached"] = tu.cached;
+        entry["prefiltered"] = tu.prefiltered;
+        if (!tu.preamble.empty()) {
+            entry["preamble"] = tu.preamble;
+        }
+        entry["phases"] = phasesJson(tu.phases);
+        perTU.push_back(std::move(entry));
+    }
+
+    json totalsJson = countersJson(totals);
+    totalsJson["phases"] = phasesJson(tuPhases);
+
+    json stats{
+        {"peak_rss_kb", peakRssKb()},
+        {"cpu_ms", processCpuMs()},
+        {"phases", phasesJson(processPhases)},
+        {"totals", totalsJson},
+        {"tus", perTU}
+    };
+    if (cache.enabled) {
+        size_t lookups = cache.hits + cache.misses;
+        stats["cache"] = {
+            {"hits", cache.hits},
+            {"misses", cache.misses},
+            {"hit_rate", lookups ? static_cast<double>(cache.hits) / lookups : 0.0}
+        };
+    }
+    return stats;
+}
+
+// Chrome trace-event format: one complete ("X") event per phase, one
+// trace thread per worker, loadable in chrome://tracing or Perfetto.
+inline json traceDocument(const std::vector<TUStats> &tus, const std::vector<PhaseTime> &processPhases,
+                          unsigned mainThread) {
+    json events = json::array();
+    auto add = [&](const PhaseTime &phase, unsigned thread, const json &args) {
+        events.push_back({
+            {"name", phase.name},
+            {"ph", "X"},
+            {"ts", phase.startUs},
+            {"dur", phase.wallMs * 1000},
+            {"pid", 1},
+            {"tid", thread},
+            {"args", args}
+        });
+    };
+    for (const auto &phase : processPhases) {
+        add(phase, mainThread, json::object());
+    }
+    for (const auto &tu : tus) {
+        for (const auto &phase : tu.phases) {
+            add(phase, tu.thread, json{{"file", tu.file}, {"cpu_ms", phase.cpuMs}});
+        }
+    }
+    return json{{"traceEvents", events}, {"displayTimeUnit", "ms"}};
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include "AnalysisServer.h"
+
+#include <llvm/Support/ErrorHandling.h>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+// Per-job resource limits; 0 means unlimited.
+struct BatchLimits {
+    unsigned memoryMb = 0;
+    unsigned cpuSeconds = 0;
+};
+
+// -batch=<manifest>: runs many independent jobs through a pool of forked
+// worker processes, so a crash or a limit breach only loses one job.
+//
+// The manifest has one job per line, in the server's request format plus
+// optional limits:
+//   {"id": "s1", "files": ["s1/main.cpp"], "mode": "vars", "args": [...],
+//    "build_path": "...", "memory_mb": 1024, "cpu_seconds": 20}
+// Each job is answered with one line on stdout, in completion order:
+//   {"id": "s1", "status": "ok", "result": {...}}
+//   {"id": "s2", "status": "error" | "crashed" | "killed" | "memory_limit" | "cpu_limit", "error": "..."}
+//
+// memory_mb caps the worker's whole address space (RLIMIT_AS) while the
+// job runs; cpu_seconds caps the CPU time the job may add (RLIMIT_CPU).
+// A worker that dies is replaced by a fresh fork before the next job.
+class BatchRunner {
+public:
+    BatchRunner(AnalysisServer &handler, unsigned workers, BatchLimits defaults)
+        : _handler(handler), _workerCount(workers ? workers : std::max(1u, std::thread::hardware_concurrency())),
+          _defaults(defaults) {}
+
+    // Must be called while the process is single-threaded: workers are
+    // forked from it.
+    int run(const std::string &manifestPath) {
+        std::ifstream manifest(manifestPath);
+        if (!manifest) {
+            std::cerr << "Cannot open batch manifest " << manifestPath << std::endl;
+            return 1;
+        }
+        std::string line;
+        while (std::getline(manifest, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            json job = json::parse(line, nullptr, false);
+            if (job.is_discarded() || !job.is_object()) {
+                emit(json{{"id", nullptr}, {"status", "error"}, {"error", "invalid manifest line: " + line}});
+                continue;
+            }
+            // Checked here, where a bad value costs one error line rather
+            // than a worker.
+            std::string error = limitsError(job);
+            if (!error.empty()) {
+                emit(json{{"id", AnalysisServer::requestId(job)}, {"status", "error"}, {"error", error}});
+                continue;
+            }
+            _jobs.push_back(std::move(job));
+        }
+
+        // A write to a worker that just died must fail, not kill the batch.
+        signal(SIGPIPE, SIG_IGN);
+
+        std::deque<size_t> pending;
+        for (size_t i = 0; i < _jobs.size(); ++i) {
+            pending.push_back(i);
+        }
+        _workers.resize(std::min<size_t>(_workerCount, std::max<size_t>(_jobs.size(), 1)));
+        for (auto &worker : _workers) {
+            if (!spawn(worker)) return 1;
+        }
+
+        size_t finished = 0;
+        while (finished < _jobs.size()) {
+            for (auto &worker : _workers) {
+                if (worker.job || pending.empty()) continue;
+                size_t job = pending.front();
+                if (sendJob(worker, job)) {
+                    pending.pop_front();
+                } else if (!restart(worker)) {
+                    return 1;
+                }
+            }
+
+            std::vector<pollfd> fds;
+            std::vector<Worker *> polled;
+            for (auto &worker : _workers) {
+                if (worker.job) {
+                    fds.push_back({worker.fromWorker, POLLIN, 0});
+                    polled.push_back(&worker);
+                }
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "poll: " << std::strerror(errno) << std::endl;
+                return 1;
+            }
+
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (!fds[i].revents) continue;
+                Worker &worker = *polled[i];
+                char chunk[64 * 1024];
+                ssize_t n = read(worker.fromWorker, chunk, sizeof(chunk));
+                if (n > 0) {
+                    worker.buffer.append(chunk, n);
+                    size_t newline = worker.buffer.find('\n');
+                    if (newline != std::string::npos) {
+                        json response = json::parse(worker.buffer.substr(0, newline), nullptr, false);
+                        worker.buffer.erase(0, newline + 1);
+                        finish(*worker.job, response.is_object() ? response
+                                                                 : failure("crashed", "unreadable worker response"));
+                        worker.job.reset();
+                        ++finished;
+                    }
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) continue;
+
+                // The worker exited in the middle of a job.
+                json outcome = reap(worker);
+                finish(*worker.job, outcome);
+                worker.job.reset();
+                ++finished;
+                if (!restart(worker)) return 1;
+            }
+        }
+
+        for (auto &worker : _workers) {
+            close(worker.toWorker);
+            close(worker.fromWorker);
+            waitpid(worker.pid, nullptr, 0);
+        }
+        return 0;
+    }
+
+private:
+    // Exit status of a worker whose allocation failed under its RLIMIT_AS.
+    static constexpr int MemoryLimitExit = 86;
+
+    struct Worker {
+        pid_t pid = -1;
+        int toWorker = -1;
+        int fromWorker = -1;
+        std::string buffer;
+        std::optional<size_t> job;
+    };
+
+    AnalysisServer &_handler;
+    unsigned _workerCount;
+    BatchLimits _defaults;
+    std::vector<json> _jobs;
+    std::vector<Worker> _workers;
+
+    static void emit(const json &line) {
+        std::cout << line.dump() << std::endl;
+    }
+
+    static json failure(const char *status, const std::string &error) {
+        return json{{"status", status}, {"error", error}};
+    }
+
+    // Why the job's limits are unusable, or empty when they are fine.
+    static std::string limitsError(const json &job) {
+        for (const char *field : {"memory_mb", "cpu_seconds"}) {
+            if (job.contains(field) &&
+                !(job[field].is_number_unsigned() && job[field].get<uint64_t>() <= UINT_MAX)) {
+                return std::string("\"") + field + "\" must be a non-negative integer";
+            }
+        }
+        return "";
+    }
+
+    void finish(size_t job, json outcome) {
+        outcome["id"] = AnalysisServer::requestId(_jobs[job]);
+        emit(outcome);
+    }
+
+    bool spawn(Worker &worker) {
+        int toWorker[2];
+        int fromWorker[2];
+        if (pipe(toWorker) < 0) {
+            std::cerr << "pipe: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (pipe(fromWorker) < 0) {
+            std::cerr << "pipe: " << std::strerror(errno) << std::endl;
+            close(toWorker[0]);
+            close(toWorker[1]);
+            return false;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "fork: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (pid == 0) {
+            // Other workers' pipes must not stay open here, or they would
+            // never see end-of-file.
+            for (auto &other : _workers) {
+                if (&other != &worker && other.pid > 0) {
+                    close(other.toWorker);
+                    close(other.fromWorker);
+                }
+            }
+            close(toWorker[1]);
+            close(fromWorker[0]);
+            workerMain(toWorker[0], fromWorker[1]);
+        }
+
+        close(toWorker[0]);
+        close(fromWorker[1]);
+        worker.pid = pid;
+        worker.toWorker = toWorker[1];
+        worker.fromWorker = fromWorker[0];
+        worker.buffer.clear();
+        worker.job.reset();
+        return true;
+    }
+
+    bool sendJob(Worker &worker, size_t job) {
+        json request = _jobs[job];
+        if (!request.contains("memory_mb")) request["memory_mb"] = _defaults.memoryMb;
+        if (!request.contains("cpu_seconds")) request["cpu_seconds"] = _defaults.cpuSeconds;
+
+        std::string text = request.dump() + "\n";
+        const char *data = text.data();
+        size_t left = text.size();
+        while (left > 0) {
+            ssize_t n = write(worker.toWorker, data, left);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            left -= n;
+        }
+        worker.job = job;
+        return true;
+    }
+
+    json reap(Worker &worker) {
+        int status = 0;
+        waitpid(worker.pid, &status, 0);
+        worker.pid = -1;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == MemoryLimitExit) {
+            return failure("memory_limit", "job exceeded its memory limit");
+        }
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGXCPU) {
+            return failure("cpu_limit", "job exceeded its CPU time limit");
+        }
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL) {
+            return failure("killed", "worker was killed");
+        }
+        if (WIFSIGNALED(status)) {
+            return failure("crashed", std::string("worker killed by signal ") + strsignal(WTERMSIG(status)));
+        }
+        return failure("crashed", "worker exited with status " + std::to_string(WEXITSTATUS(status)));
+    }
+
+    bool restart(Worker &worker) {
+        close(worker.toWorker);
+        close(worker.fromWorker);
+        if (worker.pid > 0) {
+            kill(worker.pid, SIGKILL);
+            waitpid(worker.pid, nullptr, 0);
+        }
+        return spawn(worker);
+    }
+
+    static void setSoftLimit(int resource, rlim_t value) {
+        rlimit limit;
+        if (getrlimit(resource, &limit) < 0) return;
+        limit.rlim_cur = limit.rlim_max == RLIM_INFINITY ? value : std::min(value, limit.rlim_max);
+        setrlimit(resource, &limit);
+    }
+
+    static void clearSoftLimit(int resource) {
+        rlimit limit;
+        if (getrlimit(resource, &limit) < 0) return;
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(resource, &limit);
+    }
+
+    static void onAllocationFailure() {
+        _exit(MemoryLimitExit);
+    }
+
+    [[noreturn]] void workerMain(int inFd, int outFd) {
+        // Out-of-memory has to end the process quietly and recognizably,
+        // whether it surfaces in operator new or in LLVM's own allocators.
+        std::set_new_handler(onAllocationFailure);
+        llvm::install_bad_alloc_error_handler([](void *, const char *, bool) { onAllocationFailure(); });
+        signal(SIGPIPE, SIG_DFL);
+
+        Connection connection(inFd, outFd, true);
+        std::string line;
+        while (connection.readLine(line)) {
+            json job = json::parse(line, nullptr, false);
+            unsigned memoryMb = job.value("memory_mb", 0u);
+            unsigned cpuSeconds = job.value("cpu_seconds", 0u);
+
+            if (memoryMb) {
+                setSoftLimit(RLIMIT_AS, static_cast<rlim_t>(memoryMb) << 20);
+            }
+            if (cpuSeconds) {
+                // RLIMIT_CPU counts the whole life of the process.
+                rusage usage;
+                getrusage(RUSAGE_SELF, &usage);
+                setSoftLimit(RLIMIT_CPU, usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1 + cpuSeconds);
+            }
+
+            json response;
+            std::string error;
+            json result = _handler.handle(job, error);
+            if (error.empty()) {
+                response = {{"status", "ok"}, {"result", std::move(result)}};
+            } else {
+                response = failure("error", error);
+            }
+
+            clearSoftLimit(RLIMIT_AS);
+            clearSoftLimit(RLIMIT_CPU);
+            connection.writeLine(response);
+        }
+        _exit(0);
+    }
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef COMBINED_ANALYZER_H
+#define COMBINED_ANALYZER_H
+
+#include "FunctionAnalyzer.h"
+#include "PreExecuteAnalyzer.h"
+#include "TUContext.h"
+#include "VisitorPipeline.h"
+
+#include <clang/AST/ASTConsumer.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendAction.h>
+#include <clang/Tooling/Tooling.h>
+#include <memory>
+
+using namespace clang;
+
+// Runs the variable, test and function analyses over one parse of the TU
+// and a single walk of its AST.
+class CombinedConsumer : public ASTConsumer {
+public:
+    CombinedConsumer(ASTContext &Context, SourceManager &SM, Data &data, Strings &strings, bool &canTest,
+                     FunctionData &functions, const TUContext *context = nullptr)
+        : scope(SM, context ? &context->traversalFiles : nullptr), varVisitor(Context, SM, data, context, &scope),
+          testVisitor(Context, SM, strings, canTest, &scope), functionVisitor(Context, SM, functions, context),
+          _budget(context ? context->budget : nullptr) {}
+
+    // FunctionVisitor reports header definitions too, so the whole TU is
+    // walked; the other two stages drop out at header declarations.
+    void HandleTranslationUnit(ASTContext &Context) override {
+        FusedVisitor<VariableVisitor, TestVisitor, FunctionVisitor> visitor(varVisitor, testVisitor, functionVisitor);
+        visitor.setBudget(_budget);
+        visitor.TraverseDecl(Context.getTranslationUnitDecl());
+    }
+
+private:
+    TraversalScope scope;
+    VariableVisitor varVisitor;
+    TestVisitor testVisitor;
+    FunctionVisitor functionVisitor;
+    TUBudget *_budget;
+};
+
+class CombinedAction : public ASTFrontendAction {
+public:
+    CombinedAction(Data &data, Strings &strings, bool &canTest, FunctionData &functions, TUContext *context = nullptr)
+        : _data(data), _strings(strings), _canTest(canTest), _functions(functions), _context(context) {}
+
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef) override {
+        std::unique_ptr<ASTConsumer> consumer = std::make_unique<CombinedConsumer>(
+            CI.getASTContext(), CI.getSourceManager(), _data, _strings, _canTest, _functions, _context);
+        return _context ? _context->attach(CI, std::move(consumer)) : std::move(consumer);
+    }
+
+private:
+    Data &_data;
+    Strings &_strings;
+    bool &_canTest;
+    FunctionData &_functions;
+    TUContext *_context;
+};
+
+class CombinedFactory : public tooling::FrontendActionFactory {
+public:
+    CombinedFactory(Data &data, Strings &strings, bool &canTest, FunctionData &functions, TUContext *context = nullptr)
+        : _data(data), _strings(strings), _canTest(canTest), _functions(functions), _context(context) {}
+
+    std::unique_ptr<FrontendAction> create() override {
+        return std::make_unique<CombinedAction>(_data, _strings, _canTest, _functions, _context);
+    }
+
+private:
+    Data &_data;
+    Strings &_strings;
+    bool &_canTest;
+    FunctionData &_functions;
+    TUContext *_context;
+};
+
+#endif
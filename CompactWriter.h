@@ -0,0 +1,128 @@
+#ifndef COMPACT_WRITER_H
+#define COMPACT_WRITER_H
+
+#include "AnalysisRunner.h"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// Binary output (--format=cbor / --format=msgpack). The document is one map
+// encoded with the chosen format:
+//
+//   "schema"     "input-analyzer-compact"
+//   "version"    CompactSchemaVersion; bumped on any layout change
+//   "table"      array of every distinct string in the document
+//
+// Every string below is an unsigned index into "table" and every record is
+// a positional array rather than a map. The remaining keys follow the json
+// output and depend on the mode:
+//
+//   "strings"    [[type, filename], ...]                       (vars, all)
+//   "variables"  [[name, type, line, column], ...]             (vars, all)
+//   "can_test"   bool                                          (vars, all)
+//   "functions"  [[name, returnType,                          (funcs, all)
+//                  [[type, title], ...],                        parameters
+//                  [line, column], [line, column],              startPos, endPos
+//                  type,
+//                  [[var, [enumerator, ...]], ...],             enumValues
+//                  [[var, [name, ...]], ...],                   argumentVariables
+//                  usr,                                         "" for main-file functions
+//                  [file, ...]], ...]                           TUs that defined it
+//   "abandoned"  [[file, status], ...]    only when a TU went over budget
+constexpr unsigned CompactSchemaVersion = 2;
+
+class StringTable {
+public:
+    unsigned intern(llvm::StringRef text) {
+        auto [it, inserted] = _indices.try_emplace(text, static_cast<unsigned>(_strings.size()));
+        if (inserted) {
+            _strings.push_back(text.str());
+        }
+        return it->second;
+    }
+
+    template <typename Text>
+    json internAll(const std::vector<Text> &texts) {
+        json indices = json::array();
+        for (const auto &text : texts) {
+            indices.push_back(intern(text));
+        }
+        return indices;
+    }
+
+    const std::vector<std::string> &strings() const { return _strings; }
+
+private:
+    llvm::StringMap<unsigned> _indices;
+    std::vector<std::string> _strings;
+};
+
+inline json compactDocument(const std::vector<TUResult> &results, AnalysisMode mode) {
+    StringTable table;
+    json document = json::object();
+
+    if (mode == Variables || mode == All) {
+        bool canTest = false;
+        json strings = json::array();
+        json variables = json::array();
+        for (const auto &tu : results) {
+            for (const auto &[type, filename] : tu.strings) {
+                strings.push_back({table.intern(type), table.intern(filename)});
+            }
+            for (const auto &variable : tu.variables) {
+                variables.push_back({table.intern(variable.name), table.intern(variable.type), variable.pos.first,
+                                     variable.pos.second});
+            }
+            canTest = canTest || tu.canTest;
+        }
+        document["strings"] = std::move(strings);
+        document["variables"] = std::move(variables);
+        document["can_test"] = canTest;
+    }
+    if (mode == Functions || mode == All) {
+        json functions = json::array();
+        for (const auto &merged : mergeFunctions(results)) {
+            const Function &f = *merged.function;
+            json parameters = json::array();
+            for (const auto &[type, title] : f.parameters) {
+                parameters.push_back({table.intern(type), table.intern(title)});
+            }
+            json enumValues = json::array();
+            for (const auto &[var, values] : f.enumValues) {
+                enumValues.push_back({table.intern(var), table.internAll(values)});
+            }
+            json argumentVariables = json::array();
+            for (const auto &[var, names] : f.argumentVariables) {
+                argumentVariables.push_back({table.intern(var), table.internAll(names)});
+            }
+            functions.push_back({table.intern(f.name), table.intern(f.returnType), std::move(parameters),
+                                 {f.startPos.first, f.startPos.second}, {f.endPos.first, f.endPos.second},
+                                 table.intern(f.type), std::move(enumValues), std::move(argumentVariables),
+                                 table.intern(f.usr), table.internAll(merged.files)});
+        }
+        document["functions"] = std::move(functions);
+    }
+
+    json abandoned = json::array();
+    for (const auto &tu : results) {
+        if (!tu.status.empty()) {
+            abandoned.push_back({table.intern(tu.file), table.intern(tu.status)});
+        }
+    }
+    if (!abandoned.empty()) {
+        document["abandoned"] = std::move(abandoned);
+    }
+
+    document["schema"] = "input-analyzer-compact";
+    document["version"] = CompactSchemaVersion;
+    document["table"] = table.strings();
+    return document;
+}
+
+#endif
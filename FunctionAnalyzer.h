@@ -1,13 +1,23 @@
 #ifndef FUNCTION_ANALYZER_H
 #define FUNCTION_ANALYZER_H
 
+#include "AnalysisRecords.h"
+#include "SignatureClassifier.h"
+#include "TUContext.h"
+#include "VisitorPipeline.h"
+
 #include <clang/AST/ASTConsumer.h>
 #include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendAction.h>
+#include <clang/Index/USRGeneration.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
 #include <clang/Tooling/Tooling.h>
+#include <algorithm>
 #include <memory>
-#include <regex>
 #include <utility>
 #include <vector>
 #include <string>
@@ -17,64 +27,50 @@ using json = nlohmann::json;
 
 using namespace clang;
 
-struct Function {
-    std::string returnType;
-    std::string name;
-    std::vector<std::pair<std::string, std::string>> parameters;
-    std::pair<int, int> startPos;
-    std::pair<int, int> endPos;
-    std::string type;
-    std::vector<std::pair<std::string, std::vector<std::string>>> enumValues;
-    std::vector<std::pair<std::string, std::vector<std::string>>> argumentVariables;
-};
-
-using FunctionData = std::vector<Function>;
-
-inline void to_json(json& j, const Function &f) {
-    json parametersArray = json::array();
-    for (const auto& param : f.parameters) {
-        parametersArray.push_back({{"type", param.first}, {"title", param.second}});
-    }
-    json enumValues = json::array();
-    for(const auto& value : f.enumValues) {
-        enumValues.push_back({{"var", value.first}, {"enum", value.second}});
-    }
-    json argumentVars = json::array();
-    for(const auto& var : f.argumentVariables) {
-        argumentVars.push_back({{"var", var.first}, {"names", var.second}});
-    }
-
-    j = json{
-        {"name", f.name},
-        {"returnType", f.returnType},
-        {"parameters", parametersArray},
-        {"startPos", {f.startPos.first, f.startPos.second}},
-        {"endPos", {f.endPos.first, f.endPos.second}},
-        {"type", f.type},
-        {"enumValues", enumValues},
-        {"argumentVariables", argumentVars}
-    };
-}
-
-class FunctionVisitor : public clang::RecursiveASTVisitor<FunctionVisitor> {
+class FunctionVisitor : public clang::RecursiveASTVisitor<FunctionVisitor>, public VisitorStage {
 public:
-    explicit FunctionVisitor(clang::ASTContext &Context, clang::SourceManager &SM, FunctionData &data) 
-        : Context(Context), SM(SM), _data{data} {}
+    explicit FunctionVisitor(clang::ASTContext &Context, clang::SourceManager &SM, FunctionData &data,
+                             const TUContext *context = nullptr)
+        : Context(Context), SM(SM), _data{data}, _canonicalGlobalTypes(context && context->canonicalGlobalTypes),
+          _classifier(context && context->classifier ? *context->classifier : SignatureClassifier::builtin()),
+          _stats(context ? context->stats : nullptr), _registry(context ? context->functions : nullptr),
+          _index(context ? context->index : 0), _skipped(context ? &context->skippedFunctions : nullptr),
+          _budget(context ? context->budget : nullptr) {}
+
+    // Walking on its own (funcs mode); FusedVisitor checks the budget itself.
+    bool TraverseDecl(clang::Decl *D) {
+        if (_budget && _budget->exceeded()) {
+            return false;
+        }
+        return clang::RecursiveASTVisitor<FunctionVisitor>::TraverseDecl(D);
+    }
 
     bool VisitFunctionDecl(clang::FunctionDecl *FD) {
+        if (_stats) {
+            ++_stats->functionDeclVisits;
+        }
         if (Context.getSourceManager().isInSystemHeader(FD->getBeginLoc())) {
             return true;
         }
         if (FD->isThisDeclarationADefinition()) {
+            std::string Usr = sharedUsr(FD);
+            if (!Usr.empty() && _registry && !_registry->claim(Usr, _index)) {
+                _skipped->push_back({_data.size(), std::move(Usr)});
+                if (_stats) {
+                    ++_stats->sharedFunctionsSkipped;
+                }
+                return true;
+            }
+
             clang::QualType QT = FD->getReturnType();
             clang::PrintingPolicy PP(Context.getLangOpts());
             std::string ReturnTypeStr = QT.getAsString(PP);
 
             std::string FunctionName = FD->getNameInfo().getName().getAsString();
 
-            std::vector<std::pair<std::string, std::string>> Parameters;
-            std::vector<std::pair<std::string, std::vector<std::string>>> EnumValues;
-            std::vector<std::pair<std::string, std::vector<std::string>>> ArgumentVariables;
+            std::vector<std::pair<Symbol, Symbol>> Parameters;
+            std::vector<std::pair<Symbol, std::vector<Symbol>>> EnumValues;
+            std::vector<std::pair<Symbol, std::vector<Symbol>>> ArgumentVariables;
 
             for(unsigned i = 0; i < FD->getNumParams(); ++i) {
                 clang::ParmVarDecl *Param = FD->getParamDecl(i);
@@ -82,58 +78,56 @@ public:
                 std::string ParamTypeStr = ParamType.getAsString(PP);
                 std::string ParamName = Param->getNameAsString();
 
-                if (const clang::EnumType *EnumT = ParamType->getAs<clang::EnumType>()) {
+                if (ParamType->getAs<clang::EnumType>()) {
                     ParamTypeStr = "enumeration " + ParamTypeStr;
                 }
 
-                Parameters.push_back({ParamTypeStr, ParamName});
+                Parameters.push_back({_strings.intern(ParamTypeStr), _strings.intern(ParamName)});
             }
 
-            std::string FunctionType = determineFunctionType(Parameters);
+            llvm::SmallVector<llvm::StringRef, 8> Spellings;
+            for (const auto &Parameter : Parameters) {
+                Spellings.push_back(Parameter.first);
+            }
+            SignatureKind Kind = _classifier.classify(FD, Context, Spellings);
+            std::string FunctionType = Kind.label;
 
-            if (FunctionType != "unknown") {
-                int startParams = (FunctionType.find("array") != std::string::npos || FunctionType.find("text") != std::string::npos) ? 2 : 3;
-                for(unsigned i = startParams; i < FD->getNumParams(); ++i) {
+            Parameters.erase(Parameters.begin(),
+                             Parameters.begin() + std::min<size_t>(Kind.dropParams, Parameters.size()));
+            if (Kind.known()) {
+                for(unsigned i = Kind.extrasFrom; i < FD->getNumParams(); ++i) {
                     clang::ParmVarDecl *Param = FD->getParamDecl(i);
                     clang::QualType ParamType = Param->getType();
 
                     if (const clang::EnumType *EnumT = ParamType->getAs<clang::EnumType>()) {
                         clang::EnumDecl *EnumD = EnumT->getDecl();
-                        std::vector<std::string> Values;
+                        std::vector<Symbol> Values;
                         std::string EnumName = EnumD->getNameAsString();
                         for (auto EnumValue : EnumD->enumerators()) {
-                            Values.push_back(EnumName + "::" + EnumValue->getNameAsString());
+                            Values.push_back(_strings.intern(EnumName + "::" + EnumValue->getNameAsString()));
                         }
-                        EnumValues.push_back({Param->getNameAsString(), Values});
+                        EnumValues.push_back({_strings.intern(Param->getNameAsString()), std::move(Values)});
                     }
 
-                    std::vector<std::string> Variables;
-                    for (auto Decl : Context.getTranslationUnitDecl()->decls()) {
-                        if (auto VarDecl = llvm::dyn_cast<clang::VarDecl>(Decl)) {
-                            if (VarDecl->isDefinedOutsideFunctionOrMethod() && 
-                                VarDecl->getType().getAsString() == ParamType.getAsString()) {
-                                Variables.push_back(VarDecl->getNameAsString());
-                            }
-                        }
-                    }
-                    ArgumentVariables.push_back({Param->getNameAsString(), Variables});
+                    ArgumentVariables.push_back({_strings.intern(Param->getNameAsString()), globalsOfType(ParamType)});
                 }
             }
 
             clang::SourceLocation StartLoc = FD->getBeginLoc();
-            clang::SourceLocation EndLoc = FD->getEndLoc();
+            clang::SourceLocation EndLoc = FD->hasSkippedBody() ? skippedBodyEnd(FD) : FD->getEndLoc();
             clang::PresumedLoc PStartLoc = SM.getPresumedLoc(StartLoc);
             clang::PresumedLoc PEndLoc = SM.getPresumedLoc(EndLoc);
 
             _data.push_back({
-                ReturnTypeStr, 
-                FunctionName, 
-                Parameters, 
+                _strings.intern(ReturnTypeStr),
+                _strings.intern(FunctionName),
+                std::move(Parameters), 
                 {PStartLoc.getLine(), PStartLoc.getColumn()}, 
                 {PEndLoc.getLine(), PEndLoc.getColumn()}, 
-                FunctionType, 
-                EnumValues, 
-                ArgumentVariables
+                _strings.intern(FunctionType),
+                std::move(EnumValues), 
+                std::move(ArgumentVariables),
+                Usr
             });
         }
         return true;
@@ -143,110 +137,94 @@ private:
     clang::ASTContext &Context;
     clang::SourceManager &SM;
     FunctionData &_data;
-
-    std::string determineFunctionType(std::vector<std::pair<std::string, std::string>>& parameters) {
-        std::vector<std::string> types;
-
-        if (parameters.size() >= 8) {
-            std::string params[8] = {
-                parameters[0].first,
-                parameters[1].first,
-                parameters[2].first,
-                parameters[3].first,
-                parameters[4].first,
-                parameters[5].first,
-                parameters[6].first,
-                parameters[7].first,
-            };
-
-            bool isSizeT2 = (params[2].compare("size_t") == 0 || params[2].compare("unsigned long") == 0);
-            bool isSizeT3 = (params[3].compare("size_t") == 0 || params[3].compare("unsigned long") == 0);
-            bool isSizeT4 = (params[4].compare("size_t") == 0 || params[4].compare("unsigned long") == 0);
-            bool isSizeT5 = (params[5].compare("size_t") == 0 || params[5].compare("unsigned long") == 0);
-
-            if (params[0].compare("VideoFrame") == 0 && 
-                params[1].compare("AudioFrame") == 0 &&
-                isSizeT2 && isSizeT3 && isSizeT4 && isSizeT5 &&
-                params[6].compare("int") == 0 &&
-                params[7].compare("int") == 0
-            ) {
-                types.push_back("video");
-            }
-            parameters.erase(parameters.begin(), parameters.begin() + 8);
-            goto end;
+    bool _canonicalGlobalTypes;
+    const SignatureClassifier &_classifier;
+    TUStats *_stats;
+    FunctionRegistry *_registry;
+    size_t _index;
+    std::vector<std::pair<size_t, std::string>> *_skipped;
+    TUBudget *_budget;
+    // Type names, parameter names and labels repeat across the TU's
+    // functions; the records share one copy of each.
+    StringPool _strings;
+    // File-scope variables of the TU, built once on first use instead of
+    // rescanning the TU for every parameter: bucketed by printed type, or
+    // by canonical type with -canonical-global-types.
+    llvm::StringMap<std::vector<Symbol>> _globalsBySpelling;
+    llvm::DenseMap<const clang::Type *, std::vector<Symbol>> _globalsByType;
+    bool _globalsIndexed = false;
+
+    // Definitions in headers may be seen by every TU that includes them.
+    // Main-file functions are never shared: two TUs may well both define
+    // main() or a static helper of the same name.
+    std::string sharedUsr(clang::FunctionDecl *FD) {
+        if (SM.isInMainFile(SM.getExpansionLoc(FD->getLocation()))) {
+            return "";
+        }
+        llvm::SmallString<128> Usr;
+        if (clang::index::generateUSRForDecl(FD, Usr)) {
+            return "";
         }
+        return std::string(Usr);
+    }
 
-        if (parameters.size() >= 4) {
-            std::string firstParamType = parameters[0].first;
-            std::string secondParamType = parameters[1].first;
-            std::string thirdParamType = parameters[2].first;
-            std::string fourthParamType = parameters[3].first;
-            bool isSizeT = (secondParamType == "size_t" || secondParamType == "unsigned long");
-            if (firstParamType.compare("AudioBuffer") && isSizeT && thirdParamType.compare("int") == 0 && fourthParamType.compare("int") == 0) {
-                types.push_back("audio");
-            }
-            parameters.erase(parameters.begin(), parameters.begin() + 3);
-            goto end;
+    const clang::Type *globalTypeKey(clang::QualType T) {
+        if (_canonicalGlobalTypes) {
+            T = T.getNonReferenceType();
         }
+        return Context.getCanonicalType(T).getUnqualifiedType().getTypePtr();
+    }
 
-        if (parameters.size() >= 3) {
-            std::string firstParamType = parameters[0].first;
-            std::string secondParamType = parameters[1].first;
-            std::string thirdParamType = parameters[2].first;
-            bool isSizeT1 = (secondParamType == "size_t" || secondParamType == "unsigned long");
-            bool isSizeT2 = (thirdParamType == "size_t" || thirdParamType == "unsigned long");
-            if (firstParamType.find("**") != std::string::npos && isSizeT1 && isSizeT2) {
-                types.push_back("matrix(" + extract_base_type(firstParamType) + ")");
-                if (firstParamType.find("RGBImage") != std::string::npos) {
-                    types.push_back("image");
+    // By default a global matches when its type prints exactly like the
+    // parameter's, so same-named types of different scopes still match as
+    // they always did. With canonical matching, typedefs, cv-qualifiers and
+    // references are looked through.
+    std::vector<Symbol> globalsOfType(clang::QualType ParamType) {
+        if (!_globalsIndexed) {
+            PhaseClock Clock;
+            for (auto Decl : Context.getTranslationUnitDecl()->decls()) {
+                if (auto VarDecl = llvm::dyn_cast<clang::VarDecl>(Decl)) {
+                    if (!VarDecl->isDefinedOutsideFunctionOrMethod()) {
+                        continue;
+                    }
+                    Symbol Name = _strings.intern(VarDecl->getNameAsString());
+                    if (_canonicalGlobalTypes) {
+                        _globalsByType[globalTypeKey(VarDecl->getType())].push_back(Name);
+                    } else {
+                        _globalsBySpelling[VarDecl->getType().getAsString()].push_back(Name);
+                    }
+                    if (_stats) {
+                        ++_stats->globals;
+                    }
                 }
-                parameters.erase(parameters.begin(), parameters.begin() + 3);
-                goto end;
             }
-        } 
-        if (parameters.size() >= 2) {
-            std::string firstParamType = parameters[0].first;
-            std::string secondParamType = parameters[1].first;
-
-            bool isSizeT = (secondParamType == "size_t" || secondParamType == "unsigned long");
-
-            if (firstParamType.find('*') != std::string::npos && isSizeT) {
-                types.push_back("array(" + extract_base_type(firstParamType) + ")");                
-                if (firstParamType.find("char") != std::string::npos) {
-                    types.push_back("text");
-                }
-                parameters.erase(parameters.begin(), parameters.begin() + 2);
+            _globalsIndexed = true;
+            if (_stats) {
+                _stats->phases.push_back(Clock.stop("globals_index"));
             }
         }
-        end:
-        if (types.empty()) {
-            return "unknown";
-        } else {
-            std::string result;
-            for (size_t i = 0; i < types.size(); ++i) {
-                result += types[i];
-                if (i != types.size() - 1) {
-                    result += " ";
-                }
-            }
-            return result;
+
+        if (_canonicalGlobalTypes) {
+            auto it = _globalsByType.find(globalTypeKey(ParamType));
+            return it == _globalsByType.end() ? std::vector<Symbol>() : it->second;
         }
+        auto it = _globalsBySpelling.find(ParamType.getAsString());
+        return it == _globalsBySpelling.end() ? std::vector<Symbol>() : it->second;
     }
 
-    std::string extract_base_type(const std::string& type_str) {
-        std::regex type_regex(R"(^\s*([a-zA-Z_][a-zA-Z0-9_:]*)(\s*[\*&]*\s*)*$)");
-        std::smatch match;
-    
-        if (std::regex_match(type_str, match, type_regex)) {
-            return match[1]; // Возвращаем базовый тип
-        }
-        return ""; // Если не найдено, возвращаем пустую строку
+    // A skipped body leaves getEndLoc() at the end of the declarator. Find the
+    // closing brace in the raw tokens so endPos matches a full parse.
+    clang::SourceLocation skippedBodyEnd(clang::FunctionDecl *FD) {
+        RawFunctionBody Body = scanFunctionBody(SM, Context.getLangOpts(), FD);
+        return Body.end.isValid() ? Body.end : FD->getEndLoc();
     }
 };
 
 class FunctionConsumer : public ASTConsumer {
 public:
-    explicit FunctionConsumer(ASTContext &Context, SourceManager &SM, FunctionData &data) : Visitor(Context, SM, data) {}
+    explicit FunctionConsumer(ASTContext &Context, SourceManager &SM, FunctionData &data,
+                              const TUContext *context = nullptr)
+        : Visitor(Context, SM, data, context) {}
     void HandleTranslationUnit(ASTContext &Context) override {
         Visitor.TraverseDecl(Context.getTranslationUnitDecl());
     }
@@ -257,24 +235,28 @@ private:
 
 class FunctionAction : public ASTFrontendAction {
 public:
-    FunctionAction(FunctionData &data) : _data(data) {}
-    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef file) override {
-        return std::make_unique<FunctionConsumer>(CI.getASTContext(), CI.getSourceManager(), _data);
+    FunctionAction(FunctionData &data, TUContext *context = nullptr) : _data(data), _context(context) {}
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef) override {
+        std::unique_ptr<ASTConsumer> consumer =
+            std::make_unique<FunctionConsumer>(CI.getASTContext(), CI.getSourceManager(), _data, _context);
+        return _context ? _context->attach(CI, std::move(consumer)) : std::move(consumer);
     }
 private:
     FunctionData &_data;
+    TUContext *_context;
 };
 
 class FunctionFactory : public tooling::FrontendActionFactory {
 public:
-    FunctionFactory(FunctionData& data) : _data(data) {}
+    FunctionFactory(FunctionData& data, TUContext *context = nullptr) : _data(data), _context(context) {}
     
     std::unique_ptr<FrontendAction> create() override {
-        return std::make_unique<FunctionAction>(_data);    
+        return std::make_unique<FunctionAction>(_data, _context);    
     }
 
 private:
     FunctionData &_data;
+    TUContext *_context;
 };
 
 #endif
\ No newline at end of file
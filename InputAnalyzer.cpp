@@ -0,0 +1,73 @@
+#include "InputAnalyzer.h"
+#include "AnalysisRunner.h"
+#include "SourceFiles.h"
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static std::string absolutePath(const std::string &directory, const std::string &path) {
+    llvm::SmallString<256> Path(path);
+    if (!llvm::sys::path::is_absolute(Path)) {
+        Path = directory;
+        llvm::sys::path::append(Path, path);
+    }
+    llvm::sys::path::remove_dots(Path, true);
+    return std::string(Path);
+}
+
+bool analyze(const AnalysisRequest &request, AnalysisResult &result, std::string &error) {
+    llvm::SmallString<256> Directory(request.directory);
+    llvm::sys::fs::make_absolute(Directory);
+    std::string directory(Directory);
+
+    // The buffers are referenced from the request, which outlives the call.
+    VirtualFiles files;
+    for (const auto &buffer : request.buffers) {
+        files.push_back({absolutePath(directory, buffer.path), llvm::StringRef(buffer.contents)});
+    }
+
+    std::vector<std::string> sources;
+    for (const auto &source : request.sources) {
+        sources.push_back(absolutePath(directory, source));
+    }
+    if (request.sources.empty()) {
+        for (const auto &[path, contents] : files) {
+            if (!isHeaderPath(path)) {
+                sources.push_back(path);
+            }
+        }
+    }
+    if (sources.empty()) {
+        error = "no sources to analyze";
+        return false;
+    }
+
+    tooling::FixedCompilationDatabase db(directory, request.args);
+    AnalysisOptions options;
+    options.mode = request.mode;
+    options.fastParse = request.fastParse;
+    options.budget = BudgetLimits{request.timeoutSeconds, request.memoryMb};
+    options.virtualFiles = files.empty() ? nullptr : &files;
+    std::vector<TUResult> results = analyzeAll(db, sources, options, request.jobs);
+
+    result = AnalysisResult();
+    for (auto &tu : results) {
+        result.variables.insert(result.variables.end(), tu.variables.begin(), tu.variables.end());
+        result.strings.insert(result.strings.end(), std::make_move_iterator(tu.strings.begin()),
+                              std::make_move_iterator(tu.strings.end()));
+        result.canTest = result.canTest || tu.canTest;
+        if (!tu.status.empty()) {
+            result.abandoned.push_back({tu.file, tu.status});
+        }
+    }
+    for (auto &merged : mergeFunctions(results)) {
+        result.functions.push_back(*merged.function);
+        result.functionFiles.push_back(std::move(merged.files));
+    }
+    return true;
+}
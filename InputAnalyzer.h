@@ -0,0 +1,64 @@
+#ifndef INPUT_ANALYZER_H
+#define INPUT_ANALYZER_H
+
+#include "AnalysisRecords.h"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+// In-process API of libinputanalyzer, for programs that would otherwise run
+// the CLI and parse its JSON. analyze() is reentrant: each call builds its
+// own compilation database and tools, so any number of calls may run at
+// once on different threads. The returned records are plain values: each
+// Symbol owns its (shared, immutable) text, so records may be copied, moved
+// out or outlive the AnalysisResult; Symbol::str() gives a std::string.
+
+// A file mapped over the disk for one call, a source or a header. Relative
+// paths are resolved against AnalysisRequest::directory.
+struct SourceBuffer {
+    std::string path;
+    std::string contents;
+};
+
+struct AnalysisRequest {
+    AnalysisMode mode = Variables;
+    // Files to analyze, from disk or `buffers`. Empty means every buffer
+    // that is not a header.
+    std::vector<std::string> sources;
+    std::vector<SourceBuffer> buffers;
+    // Compile arguments of every source, e.g. {"-std=c++17", "-DNDEBUG"}.
+    std::vector<std::string> args;
+    // Compile directory and base of relative paths; default: the current
+    // directory.
+    std::string directory;
+    // Threads for this call; 0 means one per core.
+    unsigned jobs = 1;
+    // See AnalysisOptions::fastParse.
+    bool fastParse = false;
+    // Per-source limits, as -tu-timeout and -tu-memory-mb; 0 means
+    // unlimited.
+    double timeoutSeconds = 0;
+    size_t memoryMb = 0;
+};
+
+// What the CLI's json output holds, over all sources in order. A function
+// defined in a header is listed once.
+struct AnalysisResult {
+    Data variables;
+    Strings strings;
+    bool canTest = false;
+    FunctionData functions;
+    // The sources that defined each of `functions`, in source order.
+    std::vector<std::vector<std::string>> functionFiles;
+    // (source, "timeout" | "oom") for each source abandoned over its limits.
+    std::vector<std::pair<std::string, std::string>> abandoned;
+};
+
+// False with `error` set when the request names nothing to analyze. A
+// source that fails to parse contributes what its partial AST yields, as
+// it does on the command line.
+bool analyze(const AnalysisRequest &request, AnalysisResult &result, std::string &error);
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef NDJSON_WRITER_H
+#define NDJSON_WRITER_H
+
+#include "AnalysisRunner.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Writes JSON tokens straight to a stream in the order they are produced,
+// so a record is serialized without building a json value first.
+class JsonStream {
+public:
+    explicit JsonStream(std::ostream &out) : _out(out) {}
+
+    JsonStream &beginObject() { return open('{'); }
+    JsonStream &endObject() { return close('}'); }
+    JsonStream &beginArray() { return open('['); }
+    JsonStream &endArray() { return close(']'); }
+
+    JsonStream &key(llvm::StringRef name) {
+        separate();
+        writeString(name);
+        _out << ':';
+        _first = true;
+        return *this;
+    }
+
+    JsonStream &value(llvm::StringRef text) {
+        separate();
+        writeString(text);
+        return *this;
+    }
+
+    JsonStream &value(int number) {
+        separate();
+        _out << number;
+        return *this;
+    }
+
+    JsonStream &value(size_t number) {
+        separate();
+        _out << number;
+        return *this;
+    }
+
+    JsonStream &value(bool flag) {
+        separate();
+        _out << (flag ? "true" : "false");
+        return *this;
+    }
+
+    JsonStream &value(const std::pair<int, int> &position) {
+        return beginArray().value(position.first).value(position.second).endArray();
+    }
+
+    template <typename Text>
+    JsonStream &value(const std::vector<Text> &texts) {
+        beginArray();
+        for (const auto &text : texts) {
+            value(text);
+        }
+        return endArray();
+    }
+
+    template <typename T>
+    JsonStream &field(llvm::StringRef name, const T &fieldValue) {
+        key(name);
+        return value(fieldValue);
+    }
+
+    void endLine() {
+        _out << '\n';
+        _first = true;
+    }
+
+private:
+    std::ostream &_out;
+    bool _first = true;
+
+    JsonStream &open(char bracket) {
+        separate();
+        _out << bracket;
+        _first = true;
+        return *this;
+    }
+
+    JsonStream &close(char bracket) {
+        _out << bracket;
+        _first = false;
+        return *this;
+    }
+
+    void separate() {
+        if (!_first) {
+            _out << ',';
+        }
+        _first = false;
+    }
+
+    void writeString(llvm::StringRef text) {
+        _out << '"';
+        for (char c : text) {
+            switch (c) {
+            case '"': _out << "\\\""; break;
+            case '\\': _out << "\\\\"; break;
+            case '\b': _out << "\\b"; break;
+            case '\f': _out << "\\f"; break;
+            case '\n': _out << "\\n"; break;
+            case '\r': _out << "\\r"; break;
+            case '\t': _out << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                    _out << escaped;
+                } else {
+                    _out << c;
+                }
+            }
+        }
+        _out << '"';
+    }
+};
+
+// --format=ndjson: one line per string, variable and function, written and
+// flushed as soon as its TU is handed over, then a summary line. Records
+// carry the fields of the json document plus "kind" and the source "file".
+// A header-defined function is written once, by the TU that analyzed it;
+// every other TU that defined it writes {"kind": "function_seen", "file",
+// "usr"} in its place, so readers can rebuild the json "files" lists. A TU
+// abandoned over budget writes {"kind": "abandoned", "file", "status"}.
+class NdjsonWriter {
+public:
+    NdjsonWriter(std::ostream &out, AnalysisMode mode) : _out(out), _json(out), _mode(mode) {}
+
+    void write(const TUResult &tu) {
+        if (!tu.status.empty()) {
+            begin("abandoned", tu.file).field("status", tu.status);
+            end();
+        }
+        if (_mode == Variables || _mode == All) {
+            for (const auto &[type, filename] : tu.strings) {
+                begin("string", tu.file).field("type", type).field("filename", filename);
+                end();
+            }
+            for (const auto &variable : tu.variables) {
+                begin("variable", tu.file)
+                    .field("name", variable.name)
+                    .field("type", variable.type)
+                    .field("pos", variable.pos);
+                end();
+            }
+            _canTest = _canTest || tu.canTest;
+        }
+        if (_mode == Functions || _mode == All) {
+            auto skipped = tu.skippedFunctions.begin();
+            for (size_t i = 0; i <= tu.functions.size(); ++i) {
+                for (; skipped != tu.skippedFunctions.end() && skipped->first == i; ++skipped) {
+                    begin("function_seen", tu.file).field("usr", skipped->second);
+                    end();
+                }
+                if (i < tu.functions.size()) {
+                    writeFunction(tu.file, tu.functions[i]);
+                }
+            }
+        }
+        ++_files;
+        _out.flush();
+    }
+
+    void finish() {
+        begin("summary").field("files", _files);
+        if (_mode == Variables || _mode == All) {
+            _json.field("can_test", _canTest);
+        }
+        end();
+        _out.flush();
+    }
+
+    // --stats: one final {"kind": "stats", "stats": {...}} line.
+    void writeStats(const json &stats) {
+        _out << json{{"kind", "stats"}, {"stats", stats}}.dump() << '\n';
+        _out.flush();
+    }
+
+private:
+    std::ostream &_out;
+    JsonStream _json;
+    AnalysisMode _mode;
+    size_t _files = 0;
+    bool _canTest = false;
+
+    JsonStream &begin(const char *kind, const std::string &file = "") {
+        _json.beginObject().field("kind", std::string(kind));
+        if (!file.empty()) {
+            _json.field("file", file);
+        }
+        return _json;
+    }
+
+    void end() {
+        _json.endObject().endLine();
+    }
+
+    void writeFunction(const std::string &file, const Function &f) {
+        begin("function", file)
+            .field("name", f.name)
+            .field("returnType", f.returnType)
+            .key("parameters")
+            .beginArray();
+        for (const auto &[type, title] : f.parameters) {
+            _json.beginObject().field("type", type).field("title", title).endObject();
+        }
+        _json.endArray()
+            .field("startPos", f.startPos)
+            .field("endPos", f.endPos)
+            .field("type", f.type)
+            .key("enumValues")
+            .beginArray();
+        for (const auto &[var, values] : f.enumValues) {
+            _json.beginObject().field("var", var).field("enum", values).endObject();
+        }
+        _json.endArray().key("argumentVariables").beginArray();
+        for (const auto &[var, names] : f.argumentVariables) {
+            _json.beginObject().field("var", var).field("names", names).endObject();
+        }
+        _json.endArray();
+        if (!f.usr.empty()) {
+            _json.field("usr", f.usr);
+        }
+        end();
+    }
+};
+
+#endif
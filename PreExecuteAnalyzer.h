@@ -1,6 +1,10 @@
 #ifndef VARIABLE_ANALYZER_H
 #define VARIABLE_ANALYZER_H
 
+#include "AnalysisRecords.h"
+#include "TUContext.h"
+#include "VisitorPipeline.h"
+
 #include <clang/AST/ASTConsumer.h>
 #include <clang/AST/ExprCXX.h>
 #include <clang/AST/RecursiveASTVisitor.h>
@@ -8,6 +12,7 @@
 #include <clang/Frontend/FrontendAction.h>
 #include <clang/Tooling/Tooling.h>
 #include <llvm-18/llvm/Support/raw_ostream.h>
+#include <algorithm>
 #include <utility>
 #include <vector>
 #include <nlohmann/json.hpp>
@@ -16,43 +21,57 @@ using json = nlohmann::json;
 
 using namespace clang;
 
-struct Variable {
-    std::string type;
-    std::string name;
-    std::pair<int, int> pos;
-};
-
-using Data = std::vector<Variable>;
-
-inline void to_json(json& j, const Variable& v) {
-    j = json{
-        {"name", v.name},
-        {"type", v.type},
-        {"pos", {v.pos.first, v.pos.second}}
-    };
-}
-
-
-class VariableVisitor : public RecursiveASTVisitor<VariableVisitor> {
+class VariableVisitor : public RecursiveASTVisitor<VariableVisitor>, public VisitorStage {
 public:
-    explicit VariableVisitor(ASTContext &Context, SourceManager &SM, Data &data)
-        : Context(Context), SM(SM), _data(data) {}
+    explicit VariableVisitor(ASTContext &Context, SourceManager &SM, Data &data, const TUContext *context = nullptr,
+                             TraversalScope *scope = nullptr)
+        : Context(Context), SM(SM), _data(data), _stats(context ? context->stats : nullptr),
+          _presizeCaches(context && context->presizeCaches), _scope(scope) {}
+
+    ~VariableVisitor() {
+        if (_stats) {
+            _stats->variableCache.add(_variableCache);
+            _stats->cinCache.add(_cinCache);
+        }
+    }
 
     bool shouldVisitTemplateInstantiations() const { return false; }
     bool shouldVisitImplicitCode() const { return false; }
 
-    bool shouldVisitDecl(Decl *D) {
-        return SM.isWrittenInMainFile(D->getLocation());
+    // Header declarations are skipped with their whole subtree.
+    bool shouldTraverseDecl(Decl *D) {
+        return !_scope || _scope->allows(D);
+    }
+
+    bool TraverseDecl(Decl *D) {
+        if (D && !shouldTraverseDecl(D)) {
+            return true;
+        }
+        return RecursiveASTVisitor<VariableVisitor>::TraverseDecl(D);
+    }
+
+    // Calls written outside the main file are skipped with their arguments.
+    bool shouldTraverseStmt(Stmt *S) {
+        switch (S->getStmtClass()) {
+        case Stmt::CallExprClass:
+        case Stmt::CXXOperatorCallExprClass:
+            return SM.isWrittenInMainFile(S->getBeginLoc());
+        default:
+            return true;
+        }
     }
 
     bool TraverseCallExpr(CallExpr *CE) {
-        if (!SM.isWrittenInMainFile(CE->getBeginLoc())) {
+        if (!shouldTraverseStmt(CE)) {
             return true;
         }
         return RecursiveASTVisitor<VariableVisitor>::TraverseCallExpr(CE);
     }
 
     bool VisitCallExpr(CallExpr *CE) {
+        if (_stats) {
+            ++_stats->callExprVisits;
+        }
         if (!SM.isWrittenInMainFile(CE->getBeginLoc())) {
             return true;
         }
@@ -66,7 +85,7 @@ public:
     }
 
     bool TraverseCXXOperatorCallExpr(CXXOperatorCallExpr *OCE) {
-        if (!SM.isWrittenInMainFile(OCE->getBeginLoc())) {
+        if (!shouldTraverseStmt(OCE)) {
             return true;
         }
         return RecursiveASTVisitor<VariableVisitor>::TraverseCXXOperatorCallExpr(OCE);
@@ -87,6 +106,41 @@ private:
     ASTContext &Context;
     SourceManager &SM;
     Data &_data;
+    TUStats *_stats;
+    bool _presizeCaches;
+    TraversalScope *_scope;
+    bool _cachesSized = false;
+    // Both caches belong to this TU's visitor and die with it. A hit adds
+    // the variable's interned type and name without printing the type again.
+    StringPool _strings;
+    llvm::SmallPtrSet<VarDecl*, 4> cinDecls;
+    llvm::DenseMap<VarDecl*, std::pair<Symbol, Symbol>> cache;
+    CacheCounter _cinCache;
+    CacheCounter _variableCache;
+
+    // Reserves the variable cache for every variable declared at file scope
+    // or directly in a function of the main file. Only the decl lists are
+    // scanned, not the statements.
+    void sizeCaches() {
+        _cachesSized = true;
+        if (!_presizeCaches) {
+            return;
+        }
+        unsigned count = 0;
+        for (Decl *D : Context.getTranslationUnitDecl()->decls()) {
+            if (!SM.isWrittenInMainFile(D->getLocation())) {
+                continue;
+            }
+            if (auto *FD = dyn_cast<FunctionDecl>(D)) {
+                for (Decl *Local : FD->decls()) {
+                    count += isa<VarDecl>(Local);
+                }
+            } else {
+                count += isa<VarDecl>(D);
+            }
+        }
+        cache.reserve(count);
+    }
 
     void processScanfArguments(CallExpr *CE) {
         SourceLocation CallLoc = CE->getBeginLoc();
@@ -113,12 +167,14 @@ private:
     }
 
     bool refersToCin(Expr *E) {
-        static llvm::SmallPtrSet<VarDecl*, 4> cinDecls;
-        
         E = E->IgnoreParenCasts();
         if (DeclRefExpr *DRE = dyn_cast<DeclRefExpr>(E)) {
             if (VarDecl *VD = dyn_cast<VarDecl>(DRE->getDecl())) {
-                if (cinDecls.count(VD)) return true;
+                ++_cinCache.lookups;
+                if (cinDecls.count(VD)) {
+                    ++_cinCache.hits;
+                    return true;
+                }
                 bool isCin = VD->getIdentifier() && 
                             VD->getName() == "cin" &&
                             VD->isInStdNamespace();
@@ -134,59 +190,82 @@ private:
     }
 
     void addVariable(Expr *E, SourceLocation Loc) {
-        static llvm::DenseMap<VarDecl*, std::pair<std::string, std::string>> cache;
-        
         E = E->IgnoreParenCasts();
         if (DeclRefExpr *DRE = dyn_cast<DeclRefExpr>(E)) {
             if (VarDecl *VD = dyn_cast<VarDecl>(DRE->getDecl())) {
                 if (!VD->getIdentifier() || VD->getName().empty()) return;
+                if (!_cachesSized) {
+                    sizeCaches();
+                }
                 
+                ++_variableCache.lookups;
                 auto it = cache.find(VD);
                 if (it != cache.end()) {
+                    ++_variableCache.hits;
                     PresumedLoc PLoc = SM.getPresumedLoc(Loc);
-                    _data.push_back({it->second.first, it->second.second, 
-                                    {PLoc.getLine(), PLoc.getColumn()}});
+                    _data.push_back({it->second.first, it->second.second, {PLoc.getLine(), PLoc.getColumn()}});
                     return;
                 }
                 
                 QualType QT = VD->getType().getUnqualifiedType();
                 PrintingPolicy PP(Context.getLangOpts());
-                std::string TypeStr = QT.getAsString(PP);
-                std::string Name = VD->getName().str();
+                Symbol Type = _strings.intern(QT.getAsString(PP));
+                Symbol Name = _strings.intern(VD->getName());
                 
-                cache[VD] = {TypeStr, Name};
+                cache[VD] = {Type, Name};
                 
                 PresumedLoc PLoc = SM.getPresumedLoc(Loc);
-                _data.push_back({TypeStr, Name, {PLoc.getLine(), PLoc.getColumn()}});
+                _data.push_back({Type, Name, {PLoc.getLine(), PLoc.getColumn()}});
             }
         }
     }
 };
     
-class TestVisitor : public RecursiveASTVisitor<TestVisitor> {
+class TestVisitor : public RecursiveASTVisitor<TestVisitor>, public VisitorStage {
 public:
-    explicit TestVisitor(ASTContext &Context, SourceManager &SM, std::vector<std::pair<std::string, std::string>> &strings, bool& canTest)
-        : Context(Context), SM(SM), strings(strings), _canTest(canTest) {}
+    explicit TestVisitor(ASTContext &Context, SourceManager &SM, Strings &strings, bool& canTest,
+                         TraversalScope *scope = nullptr)
+        : Context(Context), SM(SM), strings(strings), _canTest(canTest), _scope(scope) {}
 
     bool shouldVisitTemplateInstantiations() const { return false; }
     bool shouldVisitImplicitCode() const { return false; }
 
-    bool shouldVisitDecl(Decl *D) {
-        return SM.isWrittenInMainFile(D->getLocation());
+    bool shouldTraverseDecl(Decl *D) {
+        return !_scope || _scope->allows(D);
     }
 
-    bool TraverseFunctionDecl(FunctionDecl *FD) {
-        bool wasInMain = currentFunctionIsMain;
-        if (FD->getNameAsString() == "main") {
-            currentFunctionIsMain = true;
+    bool TraverseDecl(Decl *D) {
+        if (D && !shouldTraverseDecl(D)) {
+            return true;
         }
-        
+        return RecursiveASTVisitor<TestVisitor>::TraverseDecl(D);
+    }
+
+    bool TraverseFunctionDecl(FunctionDecl *FD) {
+        enterDecl(FD);
         bool result = RecursiveASTVisitor<TestVisitor>::TraverseFunctionDecl(FD);
-        
-        currentFunctionIsMain = wasInMain;
+        leaveDecl(FD);
         return result;
     }
 
+    void enterDecl(Decl *D) {
+        if (D->getKind() != Decl::Function) {
+            return;
+        }
+        enclosingIsMain.push_back(currentFunctionIsMain);
+        if (cast<FunctionDecl>(D)->getNameAsString() == "main") {
+            currentFunctionIsMain = true;
+        }
+    }
+
+    void leaveDecl(Decl *D) {
+        if (D->getKind() != Decl::Function) {
+            return;
+        }
+        currentFunctionIsMain = enclosingIsMain.back();
+        enclosingIsMain.pop_back();
+    }
+
     bool VisitFunctionDecl(FunctionDecl *FD) {
         if (isInSystemHeader(FD->getLocation())) {
             return true;
@@ -259,13 +338,15 @@ public:
 private:
     ASTContext &Context;
     SourceManager &SM;
-    std::vector<std::pair<std::string, std::string>> &strings;
+    Strings &strings;
     bool currentFunctionIsMain = false;
+    std::vector<bool> enclosingIsMain;
     bool requiredDataManagerFound = false;
     bool requiredFunctionManagerFound = false;
     bool requiredTestOptionsFound = false;
     bool requiredTestFunctionsFound = false;
     bool& _canTest;
+    TraversalScope *_scope;
 
     std::string file_type(const std::string& type) {
         if (type.find("DataImage") != std::string::npos) return "image";
@@ -335,43 +416,66 @@ private:
 
 class Consumer : public ASTConsumer {
 public:
-    Consumer(ASTContext &Context, SourceManager &SM, Data &data, std::vector<std::pair<std::string, std::string>> &strings, bool& canTest)
-        : varVisitor(Context, SM, data), testVisitor(Context, SM, strings, canTest) {}
-
+    Consumer(ASTContext &Context, SourceManager &SM, Data &data, Strings &strings, bool& canTest,
+             TUContext *context = nullptr)
+        : scope(SM, context ? &context->traversalFiles : nullptr), varVisitor(Context, SM, data, context, &scope),
+          testVisitor(Context, SM, strings, canTest, &scope), _stats(context ? context->stats : nullptr),
+          _budget(context ? context->budget : nullptr) {}
+
+    // Only the main file's top-level declarations are walked; the header
+    // ones around them are not even iterated past.
     void HandleTranslationUnit(ASTContext &Context) override {
-        varVisitor.TraverseDecl(Context.getTranslationUnitDecl());
-        testVisitor.TraverseDecl(Context.getTranslationUnitDecl());
+        uint64_t skipped = 0;
+        FusedVisitor<VariableVisitor, TestVisitor> visitor(varVisitor, testVisitor);
+        visitor.setBudget(_budget);
+        for (Decl *D : scope.topLevelDecls(Context.getTranslationUnitDecl(), &skipped)) {
+            if (!visitor.TraverseDecl(D)) {
+                break;
+            }
+        }
+        if (_stats) {
+            _stats->topLevelDeclsSkipped += skipped;
+        }
     }
 
 private:
+    TraversalScope scope;
     VariableVisitor varVisitor;
     TestVisitor testVisitor;
+    TUStats *_stats;
+    TUBudget *_budget;
 };
 
 class Action : public ASTFrontendAction {
 public:
-    Action(Data &data, std::vector<std::pair<std::string, std::string>> &strings, bool& canTest) : _data(data), _strings(strings), _canTest(canTest) {}
+    Action(Data &data, Strings &strings, bool& canTest, TUContext *context = nullptr)
+        : _data(data), _strings(strings), _canTest(canTest), _context(context) {}
 
-    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef file) override {
-        return std::make_unique<Consumer>(CI.getASTContext(), CI.getSourceManager(), _data, _strings, _canTest);
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef) override {
+        std::unique_ptr<ASTConsumer> consumer =
+            std::make_unique<Consumer>(CI.getASTContext(), CI.getSourceManager(), _data, _strings, _canTest, _context);
+        return _context ? _context->attach(CI, std::move(consumer)) : std::move(consumer);
     }
 private:
     Data &_data;
-    std::vector<std::pair<std::string, std::string>> &_strings;
+    Strings &_strings;
     bool& _canTest;
+    TUContext *_context;
 };
 
 class Factory : public tooling::FrontendActionFactory {
 public:
-    Factory(Data& data, std::vector<std::pair<std::string, std::string>>& strings, bool& canTest) : _data(data), _strings(strings), _canTest(canTest) {}
+    Factory(Data& data, Strings& strings, bool& canTest, TUContext *context = nullptr)
+        : _data(data), _strings(strings), _canTest(canTest), _context(context) {}
 
     std::unique_ptr<FrontendAction> create() override {
-        return std::make_unique<Action>(_data, _strings, _canTest);
+        return std::make_unique<Action>(_data, _strings, _canTest, _context);
     }
 private:
     Data &_data;
-    std::vector<std::pair<std::string, std::string>> &_strings;
+    Strings &_strings;
     bool& _canTest;
+    TUContext *_context;
 };
 
 #endif // ANALYZER_H
\ No newline at end of file
@@ -0,0 +1,277 @@
+#ifndef PREAMBLE_H
+#define PREAMBLE_H
+
+#include "SourceFiles.h"
+#include "TUContext.h"
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/FrontendActions.h>
+#include <clang/Lex/Lexer.h>
+#include <clang/Tooling/ArgumentsAdjusters.h>
+#include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace clang;
+
+// Writes the PCH to a chosen path and records the files it was built from.
+class BuildPreambleAction : public GeneratePCHAction {
+public:
+    BuildPreambleAction(std::string output, std::vector<std::string> &dependencies)
+        : _output(std::move(output)), _dependencies(dependencies) {}
+
+protected:
+    bool BeginInvocation(CompilerInstance &CI) override {
+        CI.getFrontendOpts().OutputFile = _output;
+        return GeneratePCHAction::BeginInvocation(CI);
+    }
+
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override {
+        CI.getPreprocessor().addPPCallbacks(std::make_unique<DependencyRecorder>(CI.getSourceManager(), _dependencies));
+        return GeneratePCHAction::CreateASTConsumer(CI, InFile);
+    }
+
+private:
+    std::string _output;
+    std::vector<std::string> &_dependencies;
+};
+
+// -preamble=<header>: the framework header every submission starts with is
+// parsed once into a PCH, and TUs whose first directive includes it are
+// parsed on top of that PCH instead of re-reading the header.
+//
+// A PCH only loads into a compile with the same language and target
+// options, so one is built per distinct command line (minus the source
+// file) and rebuilt when any file it was built from changes. With
+// -preamble-pch=<file>, that PCH is used as is for every TU.
+//
+// The header must have an include guard or #pragma once, so the TU's own
+// #include of it is skipped. TUContext checks that this is what happened;
+// analyzeTU() parses the TU again without the PCH otherwise.
+class Preamble {
+public:
+    explicit Preamble(std::string header, std::string prebuilt = "") : _prebuilt(std::move(prebuilt)) {
+        llvm::SmallString<256> Header(header);
+        llvm::sys::fs::make_absolute(Header);
+        llvm::sys::path::remove_dots(Header, true);
+        _header = std::string(Header);
+
+        // Created up front so that the workers forked by -batch share it
+        // and the parent removes it.
+        if (_prebuilt.empty()) {
+            llvm::SmallString<256> Prefix;
+            llvm::SmallString<256> Directory;
+            llvm::sys::path::system_temp_directory(/*ErasedOnReboot=*/true, Prefix);
+            llvm::sys::path::append(Prefix, "input-analyzer-preamble");
+            if (!llvm::sys::fs::createUniqueDirectory(Prefix, Directory)) {
+                _directory = std::string(Directory);
+            }
+        }
+    }
+
+    ~Preamble() {
+        if (!_directory.empty()) {
+            llvm::sys::fs::remove_directories(_directory);
+        }
+    }
+
+    Preamble(const Preamble &) = delete;
+    Preamble &operator=(const Preamble &) = delete;
+
+    const std::string &header() const { return _header; }
+
+    // Whether the first token of `file` starts an #include directive; only
+    // such TUs can be parsed on top of the PCH.
+    static bool startsWithInclude(const std::string &file, const VirtualFiles *virtualFiles) {
+        std::unique_ptr<llvm::MemoryBuffer> Buffer;
+        llvm::StringRef Contents;
+        if (!readSource(file, virtualFiles, Buffer, Contents)) {
+            return false;
+        }
+
+        LangOptions LangOpts;
+        LangOpts.CPlusPlus = true;
+        Lexer Lex(SourceLocation(), LangOpts, Contents.begin(), Contents.begin(), Contents.end());
+        Token Tok;
+        Lex.LexFromRawLexer(Tok);
+        if (!Tok.is(tok::hash) || !Tok.isAtStartOfLine()) return false;
+        Lex.LexFromRawLexer(Tok);
+        return Tok.is(tok::raw_identifier) && Tok.getRawIdentifier() == "include";
+    }
+
+    // Arguments adjuster for a TU compiled in `directory`: adds -include-pch
+    // with a PCH matching the final command line, building it if needed.
+    // Records what happened in `context`.
+    tooling::ArgumentsAdjuster adjuster(std::string directory, const VirtualFiles *virtualFiles, TUContext &context) {
+        return [this, directory, virtualFiles, &context](const tooling::CommandLineArguments &Args,
+                                                         StringRef Filename) {
+            tooling::CommandLineArguments Adjusted = withResourceDir(Args);
+            std::string Pch = _prebuilt;
+            if (Pch.empty()) {
+                Pch = pchFor(withoutSource(Adjusted, Filename, directory), directory, virtualFiles, context);
+                if (Pch.empty()) return Args;
+            } else if (context.recordDependencies) {
+                context.dependencies.push_back(_header);
+            }
+            Adjusted.push_back("-include-pch");
+            Adjusted.push_back(Pch);
+            context.preambleHeader = _header;
+            return Adjusted;
+        };
+    }
+
+private:
+    struct Entry {
+        std::string pch;
+        std::string error;
+        // Files the PCH was built from, with their size and modification
+        // time at the time; physical files only.
+        std::vector<std::string> dependencies;
+        std::vector<llvm::sys::fs::file_status> statuses;
+    };
+
+    std::string _header;
+    std::string _prebuilt;
+    std::string _directory;
+    std::mutex _mutex;
+    std::map<std::vector<std::string>, Entry> _entries;
+
+    // ClangTool adds -resource-dir after the adjusters run. Adding it here
+    // instead keeps it in the PCH's command line, which must match.
+    static tooling::CommandLineArguments withResourceDir(const tooling::CommandLineArguments &Args) {
+        for (const auto &Arg : Args) {
+            if (llvm::StringRef(Arg).starts_with("-resource-dir")) return Args;
+        }
+        static int StaticSymbol;
+        tooling::CommandLineArguments Adjusted = Args;
+        Adjusted.push_back("-resource-dir=" + CompilerInvocation::GetResourcesPath("clang_tool", &StaticSymbol));
+        return Adjusted;
+    }
+
+    static tooling::CommandLineArguments withoutSource(const tooling::CommandLineArguments &Args, StringRef Filename,
+                                                       const std::string &directory) {
+        llvm::SmallString<256> Source(Filename);
+        llvm::sys::fs::make_absolute(directory, Source);
+        llvm::sys::path::remove_dots(Source, true);
+
+        tooling::CommandLineArguments Stripped;
+        for (size_t i = 0; i < Args.size(); ++i) {
+            llvm::SmallString<256> Arg(Args[i]);
+            if (i > 0 && !llvm::StringRef(Args[i]).starts_with("-")) {
+                llvm::sys::fs::make_absolute(directory, Arg);
+                llvm::sys::path::remove_dots(Arg, true);
+                if (Arg == Source) continue;
+            }
+            Stripped.push_back(Args[i]);
+        }
+        return Stripped;
+    }
+
+    static bool unchanged(const Entry &entry) {
+        for (size_t i = 0; i < entry.dependencies.size(); ++i) {
+            llvm::sys::fs::file_status Status;
+            if (llvm::sys::fs::status(entry.dependencies[i], Status) ||
+                Status.getSize() != entry.statuses[i].getSize() ||
+                Status.getLastModificationTime() != entry.statuses[i].getLastModificationTime()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Builds are serialized: TUs that need a PCH being built wait for it
+    // rather than parsing the header themselves.
+    std::string pchFor(const tooling::CommandLineArguments &args, const std::string &directory,
+                       const VirtualFiles *virtualFiles, TUContext &context) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<std::string> key = args;
+        key.push_back(directory);
+
+        auto it = _entries.find(key);
+        if (it == _entries.end() || (it->second.error.empty() && !unchanged(it->second))) {
+            it = _entries.insert_or_assign(key, build(args, directory, virtualFiles)).first;
+        }
+        const Entry &entry = it->second;
+        if (!entry.error.empty()) {
+            context.preambleError = entry.error;
+            return "";
+        }
+        if (context.recordDependencies) {
+            context.dependencies.insert(context.dependencies.end(), entry.dependencies.begin(),
+                                        entry.dependencies.end());
+        }
+        return entry.pch;
+    }
+
+    Entry build(const tooling::CommandLineArguments &args, const std::string &directory,
+                const VirtualFiles *virtualFiles) {
+        Entry entry;
+        if (_directory.empty()) {
+            entry.error = "cannot create a directory for preambles";
+            return entry;
+        }
+
+        // Unique even across the processes of -batch, which share the directory.
+        llvm::SmallString<256> Model(_directory);
+        llvm::sys::path::append(Model, "preamble-%%%%%%%%.pch");
+        llvm::SmallString<256> Pch;
+        if (std::error_code EC = llvm::sys::fs::createUniqueFile(Model, Pch)) {
+            entry.error = "cannot create a preamble file: " + EC.message();
+            return entry;
+        }
+
+        llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> FS(
+            new llvm::vfs::OverlayFileSystem(llvm::vfs::createPhysicalFileSystem()));
+        if (virtualFiles) {
+            llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> Memory(new llvm::vfs::InMemoryFileSystem);
+            for (const auto &[path, contents] : *virtualFiles) {
+                Memory->addFile(path, 0, llvm::MemoryBuffer::getMemBuffer(contents));
+            }
+            FS->pushOverlay(Memory);
+        }
+        FS->setCurrentWorkingDirectory(directory);
+        llvm::IntrusiveRefCntPtr<FileManager> Files(new FileManager(FileSystemOptions(), FS));
+
+        std::vector<std::string> CommandLine = args;
+        CommandLine.push_back("-xc++-header");
+        CommandLine.push_back(_header);
+        std::vector<std::string> Dependencies;
+        tooling::ToolInvocation Invocation(std::move(CommandLine),
+                                           std::make_unique<BuildPreambleAction>(std::string(Pch), Dependencies),
+                                           Files.get());
+        if (!Invocation.run()) {
+            entry.error = "cannot build a PCH from " + _header;
+            return entry;
+        }
+
+        entry.pch = std::string(Pch);
+        for (auto &Dependency : Dependencies) {
+            llvm::sys::fs::file_status Status;
+            bool Virtual = false;
+            if (virtualFiles) {
+                for (const auto &mapped : *virtualFiles) {
+                    Virtual = Virtual || mapped.first == Dependency;
+                }
+            }
+            if (!Virtual && !llvm::sys::fs::status(Dependency, Status)) {
+                entry.statuses.push_back(Status);
+                entry.dependencies.push_back(std::move(Dependency));
+            }
+        }
+        return entry;
+    }
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include "SourceFiles.h"
+
+#include <clang/Basic/LangOptions.h>
+#include <clang/Lex/Lexer.h>
+#include <clang/Lex/Token.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace clang;
+
+// -prefilter: decides from the main file's raw tokens, before any parsing,
+// that a TU cannot produce variables, strings or can_test.
+//
+// Everything VariableVisitor and TestVisitor report is written in the main
+// file and starts from one of a few names (scanf, cin, the framework
+// classes), or reaches them through declarations the TU includes. A TU is
+// only skipped when
+//   - no identifier of the main file is, or for the classes contains,
+//     one of those names,
+//   - the main file defines no macros, and
+//   - every #include is a standard library header in <...> form,
+//   - the compile command forces no includes, changes no include search
+//     path (which could put a project header under a standard name) and
+//     defines no macro whose value could spell those names,
+// and anything the lexer cannot read plainly (line splices, universal
+// character names, computed includes) keeps the full parse.
+class LexicalPrefilter {
+public:
+    // False when the file certainly yields an empty variables result; true
+    // when it may not, or cannot be read.
+    static bool mayHaveInputs(const std::string &file, const VirtualFiles *virtualFiles) {
+        std::unique_ptr<llvm::MemoryBuffer> Buffer;
+        llvm::StringRef Contents;
+        if (!readSource(file, virtualFiles, Buffer, Contents)) {
+            return true;
+        }
+
+        LangOptions LangOpts = lexerOptions();
+        Lexer Lex(SourceLocation(), LangOpts, Contents.begin(), Contents.begin(), Contents.end());
+
+        Token Tok;
+        Lex.LexFromRawLexer(Tok);
+        while (!Tok.is(tok::eof)) {
+            if (Tok.needsCleaning()) {
+                return true;
+            }
+            if (Tok.is(tok::hash) && Tok.isAtStartOfLine()) {
+                Lex.LexFromRawLexer(Tok);
+                if (Tok.isAtStartOfLine()) {
+                    continue; // a null directive
+                }
+                if (Tok.is(tok::raw_identifier)) {
+                    llvm::StringRef Directive = Tok.getRawIdentifier();
+                    if (Directive == "define") {
+                        return true;
+                    }
+                    if (Directive == "include" || Directive == "include_next" || Directive == "import") {
+                        if (!isStandardInclude(Contents, Lex.getCurrentBufferOffset())) {
+                            return true;
+                        }
+                    }
+                }
+                // The rest of the directive is not code.
+                while (!Tok.is(tok::eof)) {
+                    Lex.LexFromRawLexer(Tok);
+                    if (Tok.isAtStartOfLine()) break;
+                }
+                continue;
+            }
+            if (Tok.is(tok::raw_identifier) && isRelevant(Tok.getRawIdentifier())) {
+                return true;
+            }
+            Lex.LexFromRawLexer(Tok);
+        }
+        return false;
+    }
+
+    // The same question for the arguments of the TU's compile commands.
+    static bool commandMayHaveInputs(const std::vector<std::string> &args) {
+        for (size_t i = 0; i < args.size(); ++i) {
+            llvm::StringRef Arg = args[i];
+            if (Arg.starts_with("-include") || Arg.starts_with("--include") || Arg.starts_with("-imacros") ||
+                changesIncludePaths(Arg)) {
+                return true;
+            }
+            if (Arg.consume_front("-D")) {
+                if (Arg.empty() && i + 1 < args.size()) {
+                    Arg = args[++i];
+                }
+                if (Arg.contains('#') || mentionsRelevant(Arg)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    static LangOptions lexerOptions() {
+        LangOptions LangOpts;
+        LangOpts.CPlusPlus = true;
+        LangOpts.CPlusPlus11 = true;
+        LangOpts.Digraphs = true;
+        return LangOpts;
+    }
+
+    // Options that add, replace or remap where <...> headers are found.
+    static bool changesIncludePaths(llvm::StringRef Arg) {
+        static const llvm::StringRef Prefixes[] = {
+            "-I", "-isystem", "-iquote", "-idirafter", "-iprefix", "-iwithprefix", "-iframework", "-F",
+            "-cxx-isystem", "-isysroot", "--sysroot", "-nostdinc", "-nostdlibinc", "-nobuiltininc",
+            "-ivfsoverlay", "-resource-dir",
+        };
+        for (llvm::StringRef Prefix : Prefixes) {
+            if (Arg.starts_with(Prefix)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool mentionsRelevant(llvm::StringRef Text) {
+        LangOptions LangOpts = lexerOptions();
+        Lexer Lex(SourceLocation(), LangOpts, Text.begin(), Text.begin(), Text.end());
+        Token Tok;
+        while (!Lex.LexFromRawLexer(Tok) || !Tok.is(tok::eof)) {
+            if (Tok.needsCleaning() || (Tok.is(tok::raw_identifier) && isRelevant(Tok.getRawIdentifier()))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool isRelevant(llvm::StringRef Identifier) {
+        // VariableVisitor matches these names exactly, but TestVisitor finds
+        // the framework classes anywhere in a type or class name, as in
+        // "MyDataImage".
+        if (Identifier == "scanf" || Identifier == "cin") {
+            return true;
+        }
+        static const llvm::StringRef ClassNames[] = {
+            "TestOptions", "FunctionManager", "DataManager", "TestFunctions",
+            "DataImage", "DataAudio", "DataVideo", "DataArray", "DataMatrix", "DataText",
+        };
+        for (llvm::StringRef Name : ClassNames) {
+            if (Identifier.contains(Name)) {
+                return true;
+            }
+        }
+        // Universal character names and extended characters can spell any
+        // of the names above.
+        for (char c : Identifier) {
+            if (c == '\\' || static_cast<unsigned char>(c) >= 0x80) return true;
+        }
+        return false;
+    }
+
+    // The header named on the rest of the directive's line, starting at
+    // `offset`, is a standard one in angle brackets.
+    static bool isStandardInclude(llvm::StringRef Contents, unsigned offset) {
+        llvm::StringRef Rest = Contents.drop_front(offset);
+        Rest = Rest.take_until([](char c) { return c == '\n' || c == '\r'; }).ltrim();
+        if (!Rest.consume_front("<")) {
+            return false;
+        }
+        size_t Close = Rest.find('>');
+        if (Close == llvm::StringRef::npos) {
+            return false;
+        }
+        static const llvm::StringSet<> Headers = {
+            "algorithm", "any", "array", "atomic", "bit", "bitset", "cassert", "cctype", "cerrno", "cfenv",
+            "cfloat", "charconv", "chrono", "cinttypes", "climits", "clocale", "cmath", "compare", "complex",
+            "concepts", "condition_variable", "csetjmp", "csignal", "cstdarg", "cstddef", "cstdint", "cstdio",
+            "cstdlib", "cstring", "ctime", "cuchar", "cwchar", "cwctype", "deque", "exception", "execution",
+            "filesystem", "format", "forward_list", "fstream", "functional", "future", "initializer_list",
+            "iomanip", "ios", "iosfwd", "iostream", "istream", "iterator", "limits", "list", "locale", "map",
+            "memory", "memory_resource", "mutex", "new", "numbers", "numeric", "optional", "ostream", "queue",
+            "random", "ranges", "ratio", "regex", "scoped_allocator", "set", "shared_mutex", "span", "sstream",
+            "stack", "stdexcept", "streambuf", "string", "string_view", "system_error", "thread", "tuple",
+            "type_traits", "typeindex", "typeinfo", "unordered_map", "unordered_set", "utility", "valarray",
+            "variant", "vector", "version",
+            "assert.h", "ctype.h", "errno.h", "fenv.h", "float.h", "inttypes.h", "limits.h", "locale.h",
+            "math.h", "setjmp.h", "signal.h", "stdarg.h", "stdbool.h", "stddef.h", "stdint.h", "stdio.h",
+            "stdlib.h", "string.h", "time.h", "uchar.h", "wchar.h", "wctype.h",
+            "bits/stdc++.h",
+        };
+        return Headers.contains(Rest.take_front(Close).trim());
+    }
+};
+
+#endif
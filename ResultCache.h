@@ -0,0 +1,223 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/BLAKE3.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// Content-addressed store for per-TU results, safe to share between
+// concurrent analyzer processes.
+//
+// Dependencies are only known after a parse, so lookups go in two steps,
+// like ccache's direct mode:
+//   <manifest key>.manifest  lists the non-system files the TU included;
+//                            the key covers mode, compile commands, extra
+//                            args and the main file's path and contents.
+//   <result key>.json        the serialized result; the key covers the
+//                            manifest key and the contents of every
+//                            dependency listed in the manifest.
+//   <result key>.ast         with -ast-cache, a directory of its own holds
+//                            serialized ASTs under the same scheme.
+// Entries are written to a temporary file and renamed into place, so
+// readers never observe a partial entry.
+class ResultCache {
+public:
+    explicit ResultCache(std::string directory) : _directory(std::move(directory)) {
+        llvm::sys::fs::create_directories(_directory);
+    }
+
+    std::optional<std::string> manifestKey(const tooling::CompilationDatabase &db, const std::string &file,
+                                           const std::string &mode, const std::vector<std::string> &extraArgs) const {
+        llvm::SmallString<256> Path(file);
+        llvm::sys::fs::make_absolute(Path);
+        llvm::sys::path::remove_dots(Path, true);
+
+        auto Buffer = llvm::MemoryBuffer::getFile(Path);
+        if (!Buffer) {
+            return std::nullopt;
+        }
+
+        llvm::BLAKE3 Hasher;
+        hashField(Hasher, FormatVersion);
+        hashField(Hasher, mode);
+        for (const auto &Command : db.getCompileCommands(Path)) {
+            hashField(Hasher, Command.Directory);
+            hashField(Hasher, Command.Filename);
+            for (const auto &Arg : Command.CommandLine) {
+                hashField(Hasher, Arg);
+            }
+        }
+        for (const auto &Arg : extraArgs) {
+            hashField(Hasher, Arg);
+        }
+        hashField(Hasher, Path);
+        hashField(Hasher, (*Buffer)->getBuffer());
+        return llvm::toHex(Hasher.final(), /*LowerCase=*/true);
+    }
+
+    // On a hit, also returns the dependency list recorded for the entry.
+    bool lookup(const std::string &manifestKey, json &value, std::vector<std::string> *dependencies = nullptr) {
+        std::vector<std::string> listed;
+        if (std::optional<std::string> path = currentEntry(manifestKey, ".json", listed)) {
+            auto Buffer = llvm::MemoryBuffer::getFile(*path);
+            if (Buffer) {
+                value = json::parse((*Buffer)->getBuffer().begin(), (*Buffer)->getBuffer().end(), nullptr, false);
+                if (!value.is_discarded()) {
+                    if (dependencies) {
+                        *dependencies = std::move(listed);
+                    }
+                    ++_hits;
+                    return true;
+                }
+            }
+        }
+        ++_misses;
+        return false;
+    }
+
+    // The same lookup for an entry kept in a file of its own, which the
+    // caller reads itself (-ast-cache): the file's path on a hit.
+    std::optional<std::string> lookupFile(const std::string &manifestKey, llvm::StringRef extension,
+                                          std::vector<std::string> *dependencies = nullptr) {
+        std::vector<std::string> listed;
+        std::optional<std::string> path = currentEntry(manifestKey, extension, listed);
+        if (!path) {
+            ++_misses;
+            return std::nullopt;
+        }
+        if (dependencies) {
+            *dependencies = std::move(listed);
+        }
+        ++_hits;
+        return path;
+    }
+
+    void store(const std::string &manifestKey, std::vector<std::string> dependencies, const json &value) {
+        storeFile(manifestKey, std::move(dependencies), ".json", value.dump());
+    }
+
+    void storeFile(const std::string &manifestKey, std::vector<std::string> dependencies, llvm::StringRef extension,
+                   llvm::StringRef contents) {
+        std::sort(dependencies.begin(), dependencies.end());
+        dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+
+        // The result goes in first: a manifest never points at a missing result.
+        std::optional<std::string> key = resultKey(manifestKey, dependencies);
+        if (!key || !atomicWrite(entryPath(*key, extension), contents)) {
+            return;
+        }
+        atomicWrite(entryPath(manifestKey, ".manifest"), json(dependencies).dump());
+    }
+
+    size_t hits() const { return _hits; }
+    size_t misses() const { return _misses; }
+
+private:
+    // Bump when the serialized result layout changes.
+    static constexpr const char *FormatVersion = "input-analyzer-cache-3";
+
+    std::string _directory;
+    std::atomic<size_t> _hits{0};
+    std::atomic<size_t> _misses{0};
+
+    static void hashField(llvm::BLAKE3 &Hasher, llvm::StringRef Field) {
+        uint64_t Size = Field.size();
+        Hasher.update(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(&Size), sizeof(Size)));
+        Hasher.update(Field);
+    }
+
+    std::string entryPath(const std::string &key, llvm::StringRef extension) const {
+        llvm::SmallString<256> Path(_directory);
+        llvm::sys::path::append(Path, key + extension.str());
+        return std::string(Path);
+    }
+
+    // The entry the manifest leads to with the dependencies as they are
+    // now, if it exists.
+    std::optional<std::string> currentEntry(const std::string &manifestKey, llvm::StringRef extension,
+                                            std::vector<std::string> &dependencies) const {
+        if (!readManifest(manifestKey, dependencies)) {
+            return std::nullopt;
+        }
+        std::optional<std::string> key = resultKey(manifestKey, dependencies);
+        if (!key) {
+            return std::nullopt;
+        }
+        std::string path = entryPath(*key, extension);
+        if (!llvm::sys::fs::exists(path)) {
+            return std::nullopt;
+        }
+        return path;
+    }
+
+    bool readManifest(const std::string &manifestKey, std::vector<std::string> &dependencies) const {
+        auto Buffer = llvm::MemoryBuffer::getFile(entryPath(manifestKey, ".manifest"));
+        if (!Buffer) {
+            return false;
+        }
+        json manifest = json::parse((*Buffer)->getBuffer().begin(), (*Buffer)->getBuffer().end(), nullptr, false);
+        if (!manifest.is_array()) {
+            return false;
+        }
+        for (const auto &entry : manifest) {
+            if (!entry.is_string()) return false;
+            dependencies.push_back(entry.get<std::string>());
+        }
+        return true;
+    }
+
+    // Hashes the manifest key together with the current contents of each
+    // dependency.
+    std::optional<std::string> resultKey(const std::string &manifestKey,
+                                         const std::vector<std::string> &dependencies) const {
+        llvm::BLAKE3 Hasher;
+        hashField(Hasher, manifestKey);
+        for (const auto &dependency : dependencies) {
+            auto Buffer = llvm::MemoryBuffer::getFile(dependency);
+            if (!Buffer) {
+                return std::nullopt;
+            }
+            hashField(Hasher, dependency);
+            hashField(Hasher, (*Buffer)->getBuffer());
+        }
+        return llvm::toHex(Hasher.final(), /*LowerCase=*/true);
+    }
+
+    bool atomicWrite(const std::string &path, llvm::StringRef contents) const {
+        int FD;
+        llvm::SmallString<256> TempPath;
+        if (llvm::sys::fs::createUniqueFile(path + ".%%%%%%%%.tmp", FD, TempPath)) {
+            return false;
+        }
+        {
+            llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+            OS << contents;
+            OS.close();
+            if (OS.has_error()) {
+                OS.clear_error();
+                llvm::sys::fs::remove(TempPath);
+                return false;
+            }
+        }
+        if (llvm::sys::fs::rename(TempPath, path)) {
+            llvm::sys::fs::remove(TempPath);
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "AnalysisRunner.h"
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/BLAKE3.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// -shard=i/N: analyze only the sources whose path hashes to shard i of N
+// (0 <= i < N). The hash is of the path as it appears in the source list,
+// so a shard always gets the same TUs, wherever and whenever it runs.
+struct ShardSpec {
+    unsigned index = 0;
+    unsigned count = 1;
+
+    static std::optional<ShardSpec> parse(llvm::StringRef text, std::string &error) {
+        auto [Index, Count] = text.split('/');
+        ShardSpec spec;
+        if (Index.getAsInteger(10, spec.index) || Count.getAsInteger(10, spec.count) || spec.count == 0 ||
+            spec.index >= spec.count) {
+            error = "expected i/N with 0 <= i < N, got \"" + text.str() + "\"";
+            return std::nullopt;
+        }
+        return spec;
+    }
+
+    bool contains(const std::string &file) const {
+        auto Hash = llvm::BLAKE3::hash<8>(llvm::arrayRefFromStringRef(file));
+        uint64_t value = 0;
+        for (uint8_t byte : Hash) {
+            value = value << 8 | byte;
+        }
+        return value % count == index;
+    }
+};
+
+// What a -shard run prints instead of the usual output: every TU it
+// analyzed, with its position in the full source list. `InputAnalyzer
+// merge` reads the documents of all N shards and prints what a single
+// run over the full list would have.
+//
+//   "schema"    "input-analyzer-shard"
+//   "version"   ShardSchemaVersion
+//   "shard"     [i, N]
+//   "mode"      "vars", "funcs" or "all"
+//   "sources"   length of the full source list
+//   "digest"    BLAKE3 of the full source list, so shards of different
+//               runs are not mixed
+//   "tus"       [{"index", "file", "variables", "strings", "can_test",
+//                 "functions", "skipped_functions": [[position, usr], ...],
+//                 "status" when abandoned over budget}]
+constexpr unsigned ShardSchemaVersion = 1;
+
+inline std::string sourcesDigest(const std::vector<std::string> &sources) {
+    llvm::BLAKE3 Hasher;
+    for (const auto &source : sources) {
+        Hasher.update(source);
+        Hasher.update(llvm::ArrayRef<uint8_t>{0});
+    }
+    return llvm::toHex(Hasher.final(), /*LowerCase=*/true);
+}
+
+inline json shardDocument(const ShardSpec &shard, AnalysisMode mode, const std::vector<std::string> &sources,
+                          const std::vector<size_t> &indices, const std::vector<TUResult> &results) {
+    json tus = json::array();
+    for (size_t i = 0; i < results.size(); ++i) {
+        json tu = results[i];
+        tu["index"] = indices[i];
+        tu["file"] = results[i].file;
+        tu["skipped_functions"] = results[i].skippedFunctions;
+        if (!results[i].status.empty()) {
+            tu["status"] = results[i].status;
+        }
+        tus.push_back(std::move(tu));
+    }
+    return json{
+        {"schema", "input-analyzer-shard"},
+        {"version", ShardSchemaVersion},
+        {"shard", {shard.index, shard.count}},
+        {"mode", modeName(mode)},
+        {"sources", sources.size()},
+        {"digest", sourcesDigest(sources)},
+        {"tus", std::move(tus)}
+    };
+}
+
+// Each shard deduplicates header-defined functions on its own, and with -j
+// the TU that analyzes one depends on scheduling. Moves every analyzed
+// copy to the first TU in source order that reached the function, as a
+// sequential single run does, and leaves the others a skipped entry.
+inline void reassignSharedFunctions(std::vector<TUResult> &results) {
+    llvm::StringMap<Function> analyzed;
+    for (auto &tu : results) {
+        for (auto &function : tu.functions) {
+            if (!function.usr.empty()) {
+                analyzed.try_emplace(function.usr, function);
+            }
+        }
+    }
+
+    llvm::StringSet<> claimed;
+    for (auto &tu : results) {
+        FunctionData functions;
+        std::vector<std::pair<size_t, std::string>> skipped;
+        auto reach = [&](llvm::StringRef usr, Function *function) {
+            if (usr.empty()) {
+                functions.push_back(std::move(*function));
+            } else if (!claimed.insert(usr).second) {
+                skipped.push_back({functions.size(), usr.str()});
+            } else if (auto it = analyzed.find(usr); it != analyzed.end()) {
+                functions.push_back(it->second);
+            }
+        };
+
+        auto next = tu.skippedFunctions.begin();
+        for (size_t i = 0; i <= tu.functions.size(); ++i) {
+            for (; next != tu.skippedFunctions.end() && next->first == i; ++next) {
+                reach(next->second, nullptr);
+            }
+            if (i < tu.functions.size()) {
+                reach(tu.functions[i].usr, &tu.functions[i]);
+            }
+        }
+        tu.functions = std::move(functions);
+        tu.skippedFunctions = std::move(skipped);
+    }
+}
+
+// Reads the documents of every shard of one run back into the TUResults of
+// the full source list, in source order.
+inline bool readShards(const std::vector<std::string> &paths, AnalysisMode &mode, std::vector<TUResult> &results,
+                       std::string &error) {
+    std::optional<unsigned> count;
+    std::string digest;
+    std::string modeText;
+    std::vector<bool> haveShard;
+    std::vector<bool> haveTU;
+
+    for (const auto &path : paths) {
+        auto Buffer = llvm::MemoryBuffer::getFile(path);
+        if (!Buffer) {
+            error = path + ": " + Buffer.getError().message();
+            return false;
+        }
+        json document = json::parse((*Buffer)->getBuffer().begin(), (*Buffer)->getBuffer().end(), nullptr, false);
+        if (!document.is_object() || document.value("schema", "") != "input-analyzer-shard") {
+            error = path + ": not a shard document";
+            return false;
+        }
+
+        try {
+            if (document.at("version").get<unsigned>() != ShardSchemaVersion) {
+                error = path + ": unsupported shard document version";
+                return false;
+            }
+            unsigned index = document.at("shard").at(0).get<unsigned>();
+            unsigned shards = document.at("shard").at(1).get<unsigned>();
+            if (!count) {
+                count = shards;
+                digest = document.at("digest").get<std::string>();
+                modeText = document.at("mode").get<std::string>();
+                haveShard.assign(shards, false);
+                haveTU.assign(document.at("sources").get<size_t>(), false);
+                results.assign(haveTU.size(), TUResult());
+            } else if (shards != *count || document.at("digest").get<std::string>() != digest ||
+                       document.at("mode").get<std::string>() != modeText) {
+                error = path + ": shard of a different run";
+                return false;
+            }
+            if (index >= shards || haveShard[index]) {
+                error = path + ": shard " + std::to_string(index) + " is out of range or given twice";
+                return false;
+            }
+            haveShard[index] = true;
+
+            for (const auto &entry : document.at("tus")) {
+                size_t position = entry.at("index").get<size_t>();
+                if (position >= haveTU.size() || haveTU[position]) {
+                    error = path + ": source " + std::to_string(position) + " is out of range or in two shards";
+                    return false;
+                }
+                haveTU[position] = true;
+                TUResult &tu = results[position];
+                entry.get_to(tu);
+                entry.at("file").get_to(tu.file);
+                entry.at("skipped_functions").get_to(tu.skippedFunctions);
+                tu.status = entry.value("status", "");
+            }
+        } catch (const json::exception &e) {
+            error = path + ": " + e.what();
+            return false;
+        }
+    }
+
+    if (!count) {
+        error = "no shard documents given";
+        return false;
+    }
+    for (unsigned i = 0; i < *count; ++i) {
+        if (!haveShard[i]) {
+            error = "shard " + std::to_string(i) + "/" + std::to_string(*count) + " is missing";
+            return false;
+        }
+    }
+    for (size_t i = 0; i < haveTU.size(); ++i) {
+        if (!haveTU[i]) {
+            error = "source " + std::to_string(i) + " is in no shard";
+            return false;
+        }
+    }
+    for (AnalysisMode candidate : {Variables, Functions, All}) {
+        if (modeText == modeName(candidate)) {
+            mode = candidate;
+            reassignSharedFunctions(results);
+            return true;
+        }
+    }
+    error = "unknown mode \"" + modeText + "\"";
+    return false;
+}
+
+#endif
@@ -0,0 +1,517 @@
+#ifndef SIGNATURE_CLASSIFIER_H
+#define SIGNATURE_CLASSIFIER_H
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/Type.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <cassert>
+#include <cctype>
+#include <climits>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+using namespace clang;
+
+// Built-in rules. They reproduce the output of the original hand-written
+// classifier exactly: note that "audio" has always accepted any first
+// parameter except AudioBuffer, and that signatures of four or more
+// parameters lose their leading three or eight in "parameters" even when
+// no type matches (the "unknown" rules).
+//
+// Top-level fields:
+//   types         "spelled" (default): patterns compare the parameter types
+//                 as printed in "parameters", as the original classifier
+//                 did; "canonical": patterns look through typedefs and
+//                 cv-qualifiers.
+//
+// Rule fields:
+//   kind          label; "{base}" becomes the first parameter's base type
+//   min_params    inclusive bounds on the parameter count (max optional)
+//   max_params
+//   params        one pattern per leading parameter
+//   tags          extra labels: {"kind", "param", "match": pattern}
+//   drop_params   leading parameters left out of "parameters" in the output
+//   extras_from   first parameter reported in enumValues/argumentVariables;
+//                 only rules of a kind other than "unknown" report any.
+//                 Without it, the original classifier's choice: the third
+//                 parameter when the final label contains "array" or
+//                 "text" anywhere, as in "matrix(Context)", else the fourth
+//
+// Patterns:
+//   "any", "size" (size_t), "character" (any character type), a builtin
+//   type name such as "int" or "unsigned long",
+//   {"named": "X"}         a typedef or class/enum named X, not through pointers
+//   {"pointer_depth": n, "pointee": pattern}   at least n levels of pointers
+//   {"not": pattern}
+// Spelled, "size" is "size_t" or "unsigned long", a builtin or "named"
+// type is that exact spelling, and "character" is any spelling containing
+// "char"; a pointee matches when the pointer's spelling contains the name.
+// Rules are tried in order and the first match wins.
+inline const char *DefaultSignatureRules = R"json({
+    "version": 1,
+    "rules": [
+        {
+            "kind": "video", "min_params": 8, "drop_params": 8,
+            "params": [{"named": "VideoFrame"}, {"named": "AudioFrame"}, "size", "size", "size", "size", "int", "int"]
+        },
+        {
+            "kind": "audio", "min_params": 4, "max_params": 7, "drop_params": 3,
+            "params": [{"not": {"named": "AudioBuffer"}}, "size", "int", "int"]
+        },
+        {
+            "kind": "matrix({base})", "min_params": 3, "max_params": 3, "drop_params": 3,
+            "params": [{"pointer_depth": 2}, "size", "size"],
+            "tags": [{"kind": "image", "param": 0, "match": {"pointer_depth": 1, "pointee": {"named": "RGBImage"}}}]
+        },
+        {
+            "kind": "array({base})", "min_params": 2, "max_params": 3, "drop_params": 2,
+            "params": [{"pointer_depth": 1}, "size"],
+            "tags": [{"kind": "text", "param": 0, "match": {"pointer_depth": 1, "pointee": "character"}}]
+        },
+        {"kind": "unknown", "min_params": 8, "drop_params": 8},
+        {"kind": "unknown", "min_params": 4, "max_params": 7, "drop_params": 3}
+    ]
+})json";
+
+struct TypePattern {
+    enum Kind {
+        Any,
+        Size,
+        Character,
+        Builtin,
+        Named,
+        Pointer,
+        Not,
+    };
+
+    Kind kind = Any;
+    BuiltinType::Kind builtin = BuiltinType::Int;
+    // The type name of Named and Builtin.
+    std::string name;
+    unsigned depth = 0;
+    // Pointee for Pointer, operand for Not; may be null for Pointer.
+    std::shared_ptr<TypePattern> inner;
+};
+
+struct SignatureRule {
+    struct Tag {
+        std::string kind;
+        unsigned param = 0;
+        TypePattern pattern;
+    };
+
+    std::string kind;
+    unsigned minParams = 0;
+    unsigned maxParams = UINT_MAX;
+    unsigned dropParams = 0;
+    std::optional<unsigned> extrasFrom;
+    std::vector<TypePattern> params;
+    std::vector<Tag> tags;
+};
+
+struct SignatureKind {
+    std::string label = "unknown";
+    unsigned dropParams = 0;
+    unsigned extrasFrom = 0;
+
+    bool known() const { return label != "unknown"; }
+};
+
+// The rule table compiled into patterns once, then shared read-only by all
+// TUs and threads.
+class SignatureClassifier {
+public:
+    static const SignatureClassifier &builtin() {
+        static const SignatureClassifier classifier = [] {
+            std::string error;
+            auto compiled = fromJson(json::parse(DefaultSignatureRules), error);
+            assert(compiled && "built-in signature rules must compile");
+            return compiled ? std::move(*compiled) : SignatureClassifier();
+        }();
+        return classifier;
+    }
+
+    static std::unique_ptr<SignatureClassifier> fromFile(const std::string &path, std::string &error) {
+        std::ifstream in(path);
+        if (!in) {
+            error = "cannot open " + path;
+            return nullptr;
+        }
+        json rules = json::parse(in, nullptr, false);
+        if (rules.is_discarded()) {
+            error = path + " is not valid JSON";
+            return nullptr;
+        }
+        return fromJson(rules, error);
+    }
+
+    static std::unique_ptr<SignatureClassifier> fromJson(const json &rules, std::string &error) {
+        auto classifier = std::make_unique<SignatureClassifier>();
+        if (!rules.is_object() || !rules.contains("rules") || !rules["rules"].is_array()) {
+            error = "expected an object with a \"rules\" array";
+            return nullptr;
+        }
+        if (rules.contains("version") && rules["version"] != 1) {
+            error = "unsupported rules version " + rules["version"].dump();
+            return nullptr;
+        }
+        if (rules.contains("types")) {
+            if (rules["types"] != "spelled" && rules["types"] != "canonical") {
+                error = "\"types\" must be \"spelled\" or \"canonical\"";
+                return nullptr;
+            }
+            classifier->_canonical = rules["types"] == "canonical";
+        }
+        for (const auto &entry : rules["rules"]) {
+            SignatureRule rule;
+            if (!parseRule(entry, rule, error)) {
+                return nullptr;
+            }
+            classifier->_rules.push_back(std::move(rule));
+        }
+        classifier->_fingerprint = rules.dump();
+        return classifier;
+    }
+
+    // `spellings` are the parameter types as "parameters" prints them.
+    SignatureKind classify(const FunctionDecl *FD, const ASTContext &Context,
+                           llvm::ArrayRef<llvm::StringRef> spellings) const {
+        unsigned count = FD->getNumParams();
+        assert(spellings.size() == count);
+        for (const auto &rule : _rules) {
+            if (count < rule.minParams || count > rule.maxParams || count < rule.params.size()) {
+                continue;
+            }
+
+            bool matched = true;
+            for (unsigned i = 0; i < rule.params.size() && matched; ++i) {
+                matched = matchesParam(rule.params[i], FD, i, spellings, Context);
+            }
+            if (!matched) {
+                continue;
+            }
+
+            SignatureKind result;
+            result.label = rule.kind;
+            size_t base = result.label.find("{base}");
+            if (base != std::string::npos) {
+                std::string name;
+                if (count) {
+                    name = _canonical ? baseName(FD->getParamDecl(0)->getType(), Context) : baseSpelling(spellings[0]);
+                }
+                result.label.replace(base, 6, name);
+            }
+            for (const auto &tag : rule.tags) {
+                if (tag.param < count && matchesParam(tag.pattern, FD, tag.param, spellings, Context)) {
+                    result.label += " " + tag.kind;
+                }
+            }
+            result.dropParams = rule.dropParams;
+            result.extrasFrom = rule.extrasFrom ? *rule.extrasFrom : labelExtrasFrom(result.label);
+            return result;
+        }
+        return SignatureKind();
+    }
+
+    // Identifies the rule set in cache keys.
+    const std::string &fingerprint() const { return _fingerprint; }
+
+private:
+    std::vector<SignatureRule> _rules;
+    std::string _fingerprint;
+    bool _canonical = false;
+
+    static unsigned labelExtrasFrom(llvm::StringRef label) {
+        return label.contains("array") || label.contains("text") ? 2 : 3;
+    }
+
+    bool matchesParam(const TypePattern &pattern, const FunctionDecl *FD, unsigned i,
+                      llvm::ArrayRef<llvm::StringRef> spellings, const ASTContext &Context) const {
+        return _canonical ? matches(pattern, FD->getParamDecl(i)->getType(), Context)
+                          : matchesSpelling(pattern, spellings[i]);
+    }
+
+    static bool matchesSpelling(const TypePattern &pattern, llvm::StringRef spelling) {
+        switch (pattern.kind) {
+        case TypePattern::Any:
+            return true;
+        case TypePattern::Size:
+            return spelling == "size_t" || spelling == "unsigned long";
+        case TypePattern::Character:
+            return spelling.contains("char");
+        case TypePattern::Builtin:
+        case TypePattern::Named:
+            return spelling == pattern.name;
+        case TypePattern::Pointer:
+            return spelling.contains(std::string(pattern.depth, '*')) &&
+                   (!pattern.inner || pointeeSpelling(*pattern.inner, spelling));
+        case TypePattern::Not:
+            return !matchesSpelling(*pattern.inner, spelling);
+        }
+        return false;
+    }
+
+    // What the original classifier checked of a pointer's pointee: whether
+    // the spelling contains a name anywhere.
+    static bool pointeeSpelling(const TypePattern &pattern, llvm::StringRef spelling) {
+        switch (pattern.kind) {
+        case TypePattern::Builtin:
+            return baseSpelling(spelling) == pattern.name;
+        case TypePattern::Named:
+            return spelling.contains(pattern.name);
+        case TypePattern::Not:
+            return !pointeeSpelling(*pattern.inner, spelling);
+        default:
+            return matchesSpelling(pattern, spelling);
+        }
+    }
+
+    // The leading identifier of a spelling followed only by pointers and
+    // references ("RGBImage **" gives "RGBImage"), and empty otherwise
+    // ("const int *", "unsigned char *").
+    static std::string baseSpelling(llvm::StringRef spelling) {
+        spelling = spelling.ltrim();
+        if (spelling.empty() || !(isalpha(static_cast<unsigned char>(spelling[0])) || spelling[0] == '_')) {
+            return "";
+        }
+        size_t length = 1;
+        while (length < spelling.size() &&
+               (isalnum(static_cast<unsigned char>(spelling[length])) || spelling[length] == '_' ||
+                spelling[length] == ':')) {
+            ++length;
+        }
+        if (spelling.drop_front(length).find_first_not_of(" \t\n\v\f\r*&") != llvm::StringRef::npos) {
+            return "";
+        }
+        return spelling.take_front(length).str();
+    }
+
+    static bool matches(const TypePattern &pattern, QualType T, const ASTContext &Context) {
+        QualType Canon = T.getCanonicalType().getUnqualifiedType();
+        switch (pattern.kind) {
+        case TypePattern::Any:
+            return true;
+        case TypePattern::Size:
+            return Canon == Context.getSizeType().getCanonicalType();
+        case TypePattern::Character:
+            return Canon->isAnyCharacterType();
+        case TypePattern::Builtin:
+            if (pattern.builtin == BuiltinType::Char_S) {
+                return Canon->isSpecificBuiltinType(BuiltinType::Char_S) ||
+                       Canon->isSpecificBuiltinType(BuiltinType::Char_U);
+            }
+            return Canon->isSpecificBuiltinType(pattern.builtin);
+        case TypePattern::Named:
+            return isNamed(T, pattern.name, Context);
+        case TypePattern::Pointer: {
+            // Walk the sugared type so the pointee keeps its typedef names.
+            QualType Pointee = T.getNonReferenceType();
+            unsigned depth = 0;
+            while (const PointerType *PT = Pointee->getAs<PointerType>()) {
+                Pointee = PT->getPointeeType();
+                ++depth;
+            }
+            return depth >= pattern.depth && (!pattern.inner || matches(*pattern.inner, Pointee, Context));
+        }
+        case TypePattern::Not:
+            return !matches(*pattern.inner, T, Context);
+        }
+        return false;
+    }
+
+    // Checks every typedef in the sugar chain and then the class or enum
+    // itself. Only identifiers are compared; no type is printed.
+    static bool isNamed(QualType T, llvm::StringRef name, const ASTContext &Context) {
+        while (true) {
+            if (const auto *TT = dyn_cast<TypedefType>(T.getTypePtr())) {
+                if (TT->getDecl()->getName() == name) return true;
+            }
+            QualType Next = T.getSingleStepDesugaredType(Context);
+            if (Next == T) break;
+            T = Next;
+        }
+        if (const TagDecl *Tag = T->getAsTagDecl()) {
+            if (Tag->getName() == name) return true;
+            if (const TypedefNameDecl *Typedef = Tag->getTypedefNameForAnonDecl()) {
+                return Typedef->getName() == name;
+            }
+        }
+        return false;
+    }
+
+    // The base type of a matched pointer parameter, as the label shows it:
+    // kept only when it prints as a single, possibly scoped, identifier
+    // without cv-qualifiers ("int", "RGBImage", "std::string"), and empty
+    // otherwise ("unsigned char", "const int"). Only runs for matched rules.
+    static std::string baseName(QualType T, const ASTContext &Context) {
+        while (true) {
+            if (T.hasLocalQualifiers()) return "";
+            const Type *Ty = T.getTypePtr();
+            if (const auto *AT = dyn_cast<AdjustedType>(Ty)) {
+                T = AT->getAdjustedType();
+            } else if (const auto *PT = dyn_cast<ParenType>(Ty)) {
+                T = PT->getInnerType();
+            } else if (const auto *PT = dyn_cast<PointerType>(Ty)) {
+                T = PT->getPointeeType();
+            } else if (const auto *RT = dyn_cast<ReferenceType>(Ty)) {
+                T = RT->getPointeeTypeAsWritten();
+            } else {
+                break;
+            }
+        }
+
+        std::string Name = T.getAsString(PrintingPolicy(Context.getLangOpts()));
+        if (Name.empty() || !(isalpha(static_cast<unsigned char>(Name[0])) || Name[0] == '_')) {
+            return "";
+        }
+        for (char c : Name) {
+            if (!(isalnum(static_cast<unsigned char>(c)) || c == '_' || c == ':')) return "";
+        }
+        return Name;
+    }
+
+    static bool builtinKind(const std::string &name, BuiltinType::Kind &kind) {
+        static const std::pair<const char *, BuiltinType::Kind> Builtins[] = {
+            {"void", BuiltinType::Void},
+            {"bool", BuiltinType::Bool},
+            {"char", BuiltinType::Char_S},
+            {"signed char", BuiltinType::SChar},
+            {"unsigned char", BuiltinType::UChar},
+            {"short", BuiltinType::Short},
+            {"unsigned short", BuiltinType::UShort},
+            {"int", BuiltinType::Int},
+            {"unsigned int", BuiltinType::UInt},
+            {"long", BuiltinType::Long},
+            {"unsigned long", BuiltinType::ULong},
+            {"long long", BuiltinType::LongLong},
+            {"unsigned long long", BuiltinType::ULongLong},
+            {"float", BuiltinType::Float},
+            {"double", BuiltinType::Double},
+            {"long double", BuiltinType::LongDouble},
+        };
+        for (const auto &[builtinName, builtin] : Builtins) {
+            if (name == builtinName) {
+                kind = builtin;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool parsePattern(const json &j, TypePattern &pattern, std::string &error) {
+        if (j.is_string()) {
+            std::string name = j.get<std::string>();
+            if (name == "any") {
+                pattern.kind = TypePattern::Any;
+            } else if (name == "size") {
+                pattern.kind = TypePattern::Size;
+            } else if (name == "character") {
+                pattern.kind = TypePattern::Character;
+            } else if (builtinKind(name, pattern.builtin)) {
+                pattern.kind = TypePattern::Builtin;
+                pattern.name = name;
+            } else {
+                error = "unknown type pattern \"" + name + "\"";
+                return false;
+            }
+            return true;
+        }
+
+        if (j.is_object() && j.contains("named") && j["named"].is_string()) {
+            pattern.kind = TypePattern::Named;
+            pattern.name = j["named"].get<std::string>();
+            return true;
+        }
+        if (j.is_object() && j.contains("pointer_depth") && j["pointer_depth"].is_number_unsigned()) {
+            pattern.kind = TypePattern::Pointer;
+            pattern.depth = j["pointer_depth"].get<unsigned>();
+            if (j.contains("pointee")) {
+                pattern.inner = std::make_shared<TypePattern>();
+                return parsePattern(j["pointee"], *pattern.inner, error);
+            }
+            return true;
+        }
+        if (j.is_object() && j.contains("not")) {
+            pattern.kind = TypePattern::Not;
+            pattern.inner = std::make_shared<TypePattern>();
+            return parsePattern(j["not"], *pattern.inner, error);
+        }
+
+        error = "invalid type pattern " + j.dump();
+        return false;
+    }
+
+    static bool parseRule(const json &entry, SignatureRule &rule, std::string &error) {
+        if (!entry.is_object() || !entry.contains("kind") || !entry["kind"].is_string()) {
+            error = "every rule needs a \"kind\" string";
+            return false;
+        }
+        rule.kind = entry["kind"].get<std::string>();
+
+        for (auto [key, value] : {std::pair<const char *, unsigned *>{"min_params", &rule.minParams},
+                                  {"max_params", &rule.maxParams},
+                                  {"drop_params", &rule.dropParams}}) {
+            if (!entry.contains(key)) continue;
+            if (!entry[key].is_number_unsigned()) {
+                error = "rule \"" + rule.kind + "\": \"" + key + "\" must be a non-negative integer";
+                return false;
+            }
+            *value = entry[key].get<unsigned>();
+        }
+        if (entry.contains("extras_from")) {
+            if (!entry["extras_from"].is_number_unsigned()) {
+                error = "rule \"" + rule.kind + "\": \"extras_from\" must be a non-negative integer";
+                return false;
+            }
+            rule.extrasFrom = entry["extras_from"].get<unsigned>();
+        }
+
+        if (entry.contains("params")) {
+            if (!entry["params"].is_array()) {
+                error = "rule \"" + rule.kind + "\": \"params\" must be an array";
+                return false;
+            }
+            for (const auto &param : entry["params"]) {
+                TypePattern pattern;
+                if (!parsePattern(param, pattern, error)) return false;
+                rule.params.push_back(std::move(pattern));
+            }
+        }
+
+        if (entry.contains("tags")) {
+            if (!entry["tags"].is_array()) {
+                error = "rule \"" + rule.kind + "\": \"tags\" must be an array";
+                return false;
+            }
+            for (const auto &tagEntry : entry["tags"]) {
+                SignatureRule::Tag tag;
+                if (!tagEntry.is_object() || !tagEntry.contains("kind") || !tagEntry["kind"].is_string() ||
+                    !tagEntry.contains("match")) {
+                    error = "rule \"" + rule.kind + "\": every tag needs \"kind\" and \"match\"";
+                    return false;
+                }
+                tag.kind = tagEntry["kind"].get<std::string>();
+                if (tagEntry.contains("param")) {
+                    if (!tagEntry["param"].is_number_unsigned()) {
+                        error = "rule \"" + rule.kind + "\": tag \"param\" must be a non-negative integer";
+                        return false;
+                    }
+                    tag.param = tagEntry["param"].get<unsigned>();
+                }
+                if (!parsePattern(tagEntry["match"], tag.pattern, error)) return false;
+                rule.tags.push_back(std::move(tag));
+            }
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SOURCE_FILES_H
+#define SOURCE_FILES_H
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// In-memory files (path, contents) mapped over the real file system. The
+// contents are referenced, not copied, and must outlive the analysis.
+using VirtualFiles = std::vector<std::pair<std::string, llvm::StringRef>>;
+
+inline bool isHeaderPath(llvm::StringRef path) {
+    llvm::StringRef extension = llvm::sys::path::extension(path);
+    return extension.equals_insensitive(".h") || extension.equals_insensitive(".hh") ||
+           extension.equals_insensitive(".hpp") || extension.equals_insensitive(".hxx") ||
+           extension == ".inc" || extension == ".ipp";
+}
+
+// The text of a source file as the analysis will see it: the mapped
+// contents with -stdin, otherwise the file on disk, kept in `storage`.
+inline bool readSource(const std::string &file, const VirtualFiles *virtualFiles,
+                       std::unique_ptr<llvm::MemoryBuffer> &storage, llvm::StringRef &contents) {
+    llvm::SmallString<256> Path(file);
+    llvm::sys::fs::make_absolute(Path);
+    llvm::sys::path::remove_dots(Path, true);
+
+    if (virtualFiles) {
+        for (const auto &[path, mapped] : *virtualFiles) {
+            if (path == Path) {
+                contents = mapped;
+                return true;
+            }
+        }
+    }
+    auto Buffer = llvm::MemoryBuffer::getFile(Path);
+    if (!Buffer) {
+        return false;
+    }
+    storage = std::move(*Buffer);
+    contents = storage->getBuffer();
+    return true;
+}
+
+#endif
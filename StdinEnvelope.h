@@ -0,0 +1,139 @@
+#ifndef STDIN_ENVELOPE_H
+#define STDIN_ENVELOPE_H
+
+#include "AnalysisRunner.h"
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// -stdin: sources arrive as one JSON document instead of files on disk.
+//
+//   {
+//     "files": [{"path": "main.cpp", "contents": "..."}, ...],
+//     "args": ["-std=c++17", "-DNDEBUG"],   compile arguments, optional
+//     "sources": ["main.cpp"],              files to analyze, optional;
+//                                           default: every non-header file
+//     "directory": "/work"                  base of relative paths and the
+//                                           compile directory; default: cwd
+//   }
+//
+// Files are mapped over the real file system, so system headers and any
+// project file not in the envelope still come from disk.
+class StdinEnvelope {
+public:
+    StdinEnvelope() = default;
+    // files() points into the parsed document.
+    StdinEnvelope(const StdinEnvelope &) = delete;
+    StdinEnvelope &operator=(const StdinEnvelope &) = delete;
+
+    bool read(std::istream &in, std::string &error) {
+        _document = json::parse(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>(), nullptr, false);
+        if (_document.is_discarded() || !_document.is_object()) {
+            error = "stdin is not a JSON object";
+            return false;
+        }
+        if (!_document.contains("files") || !_document["files"].is_array()) {
+            error = "expected a \"files\" array";
+            return false;
+        }
+
+        llvm::SmallString<256> Directory;
+        if (_document.contains("directory")) {
+            if (!_document["directory"].is_string()) {
+                error = "\"directory\" must be a string";
+                return false;
+            }
+            Directory = _document["directory"].get_ref<const std::string &>();
+        }
+        llvm::sys::fs::make_absolute(Directory);
+        _directory = std::string(Directory);
+
+        for (const auto &entry : _document["files"]) {
+            if (!entry.is_object() || !entry.contains("path") || !entry["path"].is_string() ||
+                !entry.contains("contents") || !entry["contents"].is_string()) {
+                error = "every file needs a \"path\" and \"contents\" string";
+                return false;
+            }
+            // The contents stay in the parsed document and are referenced
+            // from there, never copied again.
+            _files.push_back({absolutePath(entry["path"].get_ref<const std::string &>()),
+                              llvm::StringRef(entry["contents"].get_ref<const std::string &>())});
+        }
+
+        std::vector<std::string> args;
+        if (_document.contains("args")) {
+            if (!readStrings(_document["args"], args)) {
+                error = "\"args\" must be an array of strings";
+                return false;
+            }
+        }
+        _compilations = std::make_unique<tooling::FixedCompilationDatabase>(_directory, args);
+
+        if (_document.contains("sources")) {
+            std::vector<std::string> sources;
+            if (!readStrings(_document["sources"], sources)) {
+                error = "\"sources\" must be an array of strings";
+                return false;
+            }
+            for (const auto &source : sources) {
+                _sources.push_back(absolutePath(source));
+            }
+        } else {
+            for (const auto &[path, contents] : _files) {
+                if (!isHeaderPath(path)) {
+                    _sources.push_back(path);
+                }
+            }
+        }
+        if (_sources.empty()) {
+            error = "no sources to analyze";
+            return false;
+        }
+        return true;
+    }
+
+    const VirtualFiles &files() const { return _files; }
+    const std::vector<std::string> &sources() const { return _sources; }
+    const tooling::CompilationDatabase &compilations() const { return *_compilations; }
+
+private:
+    json _document;
+    std::string _directory;
+    VirtualFiles _files;
+    std::vector<std::string> _sources;
+    std::unique_ptr<tooling::CompilationDatabase> _compilations;
+
+    std::string absolutePath(llvm::StringRef path) const {
+        llvm::SmallString<256> Path(path);
+        if (!llvm::sys::path::is_absolute(Path)) {
+            Path = _directory;
+            llvm::sys::path::append(Path, path);
+        }
+        llvm::sys::path::remove_dots(Path, true);
+        return std::string(Path);
+    }
+
+    static bool readStrings(const json &value, std::vector<std::string> &strings) {
+        if (!value.is_array()) {
+            return false;
+        }
+        for (const auto &entry : value) {
+            if (!entry.is_string()) return false;
+            strings.push_back(entry.get<std::string>());
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/StringRef.h>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// An immutable, reference-counted string: one allocation holds the count,
+// the length and the characters, and copies of a Symbol share it. A Symbol
+// owns its text, so records stay valid wherever they are copied or moved,
+// whatever happens to the pool that produced them.
+class Symbol {
+public:
+    Symbol() = default;
+    Symbol(llvm::StringRef text) : _text(text.empty() ? nullptr : Text::create(text)) {}
+    Symbol(const std::string &text) : Symbol(llvm::StringRef(text)) {}
+    Symbol(const char *text) : Symbol(llvm::StringRef(text)) {}
+
+    llvm::StringRef ref() const { return _text ? _text->ref() : llvm::StringRef(); }
+    operator llvm::StringRef() const { return ref(); }
+    std::string str() const { return ref().str(); }
+    bool empty() const { return !_text; }
+
+    // Interned copies compare by pointer; others by their characters.
+    bool operator==(const Symbol &other) const { return _text == other._text || ref() == other.ref(); }
+    bool operator!=(const Symbol &other) const { return !(*this == other); }
+
+private:
+    struct Text : llvm::ThreadSafeRefCountedBase<Text> {
+        size_t size;
+
+        static Text *create(llvm::StringRef text) {
+            void *memory = ::operator new(sizeof(Text) + text.size() + 1);
+            Text *result = new (memory) Text();
+            result->size = text.size();
+            std::memcpy(result->chars(), text.data(), text.size());
+            result->chars()[text.size()] = '\0';
+            return result;
+        }
+
+        // Frees the whole allocation made by create().
+        static void operator delete(void *memory) { ::operator delete(memory); }
+
+        llvm::StringRef ref() const { return llvm::StringRef(chars(), size); }
+
+    private:
+        char *chars() { return reinterpret_cast<char *>(this + 1); }
+        const char *chars() const { return reinterpret_cast<const char *>(this + 1); }
+    };
+
+    llvm::IntrusiveRefCntPtr<Text> _text;
+};
+
+// Hands out one shared Symbol per distinct string. Type names, parameter
+// names and enumerators repeat across a TU's functions and variables;
+// interned, each is allocated once and the records hold 8-byte handles to
+// it. A pool belongs to one visitor, so it takes no lock, and it only
+// speeds up sharing: the Symbols it returns outlive it.
+class StringPool {
+public:
+    Symbol intern(llvm::StringRef text) {
+        if (text.empty()) {
+            return Symbol();
+        }
+        auto it = _symbols.find(text);
+        if (it != _symbols.end()) {
+            return it->second;
+        }
+        Symbol symbol(text);
+        _symbols.try_emplace(symbol.ref(), symbol);
+        return symbol;
+    }
+
+    size_t size() const { return _symbols.size(); }
+
+private:
+    // Keys point into the Symbols' own text.
+    llvm::DenseMap<llvm::StringRef, Symbol> _symbols;
+};
+
+inline void to_json(json &j, const Symbol &symbol) {
+    llvm::StringRef text = symbol.ref();
+    j = std::string_view(text.data(), text.size());
+}
+
+inline void from_json(const json &j, Symbol &symbol) {
+    symbol = Symbol(j.get_ref<const std::string &>());
+}
+
+#endif
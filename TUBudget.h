@@ -0,0 +1,172 @@
+#ifndef TU_BUDGET_H
+#define TU_BUDGET_H
+
+#include <clang/AST/ASTConsumer.h>
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/DeclGroup.h>
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Lex/MacroInfo.h>
+#include <clang/Lex/PPCallbacks.h>
+#include <clang/Lex/Preprocessor.h>
+#include <clang/Lex/Token.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+using namespace clang;
+
+// Per-TU limits (-tu-timeout, -tu-memory-mb); 0 means unlimited.
+struct BudgetLimits {
+    double seconds = 0;
+    size_t memoryMb = 0;
+
+    bool any() const { return seconds > 0 || memoryMb > 0; }
+};
+
+// What one TU may still spend. Nothing is interrupted from outside: the
+// preprocessor and consumer callbacks and the visitors ask exceeded() as
+// they go and give up once it says so. Memory is what the TU's AST and
+// preprocessor arenas hold, which is what template explosions and huge
+// generated tables grow; it is per TU even while other TUs run on other
+// threads. Once exceeded, the budget stays exceeded.
+class TUBudget {
+public:
+    enum Outcome {
+        Within,
+        Timeout,
+        OutOfMemory,
+    };
+
+    explicit TUBudget(const BudgetLimits &limits)
+        : _deadline(limits.seconds > 0
+                        ? std::chrono::steady_clock::now() +
+                              std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double>(limits.seconds))
+                        : std::chrono::steady_clock::time_point::max()),
+          _memoryBytes(limits.memoryMb * 1024 * 1024) {}
+
+    // The arenas to measure; until then only time counts.
+    void track(const ASTContext &Context, const Preprocessor *PP) {
+        _context = &Context;
+        _preprocessor = PP;
+    }
+
+    // Cheap enough for every node: the clock and the arenas are read on
+    // every CheckInterval-th call only.
+    bool exceeded() {
+        if (_outcome != Within) {
+            return true;
+        }
+        if (++_calls % CheckInterval) {
+            return false;
+        }
+        return check();
+    }
+
+    bool check() {
+        if (_outcome != Within) {
+            return true;
+        }
+        if (std::chrono::steady_clock::now() > _deadline) {
+            _outcome = Timeout;
+        } else if (_memoryBytes && memoryInUse() > _memoryBytes) {
+            _outcome = OutOfMemory;
+        }
+        return _outcome != Within;
+    }
+
+    Outcome outcome() const { return _outcome; }
+
+    // Raises the fatal error that abandons the TU, the first time a check
+    // finds the budget exceeded. Returns `exceeded`.
+    bool report(bool exceeded, DiagnosticsEngine &Diags) {
+        if (exceeded && !_reported) {
+            _reported = true;
+            Diags.Report(Diags.getCustomDiagID(DiagnosticsEngine::Fatal,
+                                               "translation unit abandoned: over its %0 budget"))
+                << (_outcome == Timeout ? "time" : "memory");
+        }
+        return exceeded;
+    }
+
+    // The status a TU abandoned for this budget reports.
+    const char *status() const {
+        switch (_outcome) {
+        case Within: return "";
+        case Timeout: return "timeout";
+        case OutOfMemory: return "oom";
+        }
+        return "";
+    }
+
+private:
+    static constexpr uint64_t CheckInterval = 1024;
+
+    std::chrono::steady_clock::time_point _deadline;
+    size_t _memoryBytes;
+    const ASTContext *_context = nullptr;
+    const Preprocessor *_preprocessor = nullptr;
+    uint64_t _calls = 0;
+    Outcome _outcome = Within;
+    bool _reported = false;
+
+    size_t memoryInUse() const {
+        size_t bytes = 0;
+        if (_context) {
+            bytes += _context->getASTAllocatedMemory() + _context->getSideTableAllocatedMemory();
+        }
+        if (_preprocessor) {
+            bytes += _preprocessor->getTotalMemory();
+        }
+        return bytes;
+    }
+};
+
+// Checks the budget whenever Sema hands over a declaration, including each
+// class and function template instantiation. Over budget, it raises a fatal
+// error, after which Sema stops instantiating templates, and ends the
+// parse at the next top-level declaration, before the analysis consumers
+// see the TU.
+class BudgetConsumer : public ASTConsumer {
+public:
+    BudgetConsumer(TUBudget &budget, DiagnosticsEngine &Diags) : _budget(budget), Diags(Diags) {}
+
+    bool HandleTopLevelDecl(DeclGroupRef) override { return !_budget.report(_budget.check(), Diags); }
+    void HandleInlineFunctionDefinition(FunctionDecl *) override { _budget.report(_budget.exceeded(), Diags); }
+    void HandleTagDeclDefinition(TagDecl *) override { _budget.report(_budget.exceeded(), Diags); }
+    void HandleCXXImplicitFunctionInstantiation(FunctionDecl *) override {
+        _budget.report(_budget.exceeded(), Diags);
+    }
+
+private:
+    TUBudget &_budget;
+    DiagnosticsEngine &Diags;
+};
+
+// Checks the budget while the preprocessor works, so that a declaration
+// Sema has not finished yet, such as a table built from macro expansions
+// or spread over generated headers, is noticed before it ends. Entering a
+// file checks at once, every macro expansion counts towards the next
+// periodic check. The fatal error stops template instantiation; the parse
+// itself still ends at BudgetConsumer's next top-level declaration.
+class BudgetPPCallbacks : public PPCallbacks {
+public:
+    BudgetPPCallbacks(TUBudget &budget, DiagnosticsEngine &Diags) : _budget(budget), Diags(Diags) {}
+
+    void FileChanged(SourceLocation, FileChangeReason Reason, SrcMgr::CharacteristicKind, FileID) override {
+        if (Reason == EnterFile) {
+            _budget.report(_budget.check(), Diags);
+        }
+    }
+
+    void MacroExpands(const Token &, const MacroDefinition &, SourceRange, const MacroArgs *) override {
+        _budget.report(_budget.exceeded(), Diags);
+    }
+
+private:
+    TUBudget &_budget;
+    DiagnosticsEngine &Diags;
+};
+
+#endif
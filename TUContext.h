@@ -0,0 +1,437 @@
+#ifndef TU_CONTEXT_H
+#define TU_CONTEXT_H
+
+#include "AnalysisStats.h"
+#include "TUBudget.h"
+
+#include <clang/AST/ASTConsumer.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/MultiplexConsumer.h>
+#include <clang/Lex/Lexer.h>
+#include <clang/Lex/PPCallbacks.h>
+#include <clang/Lex/Preprocessor.h>
+#include <clang/Lex/Token.h>
+#include <clang/Sema/Sema.h>
+#include <clang/Sema/SemaConsumer.h>
+#include <clang/Serialization/ASTWriter.h>
+#include <clang/Serialization/InMemoryModuleCache.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Bitstream/BitstreamWriter.h>
+#include <llvm/Support/Path.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace clang;
+
+class Preamble;
+class SignatureClassifier;
+
+// Owners of the header-defined functions reached during one run, shared by
+// every TU of the run so each definition is analyzed once. A definition
+// belongs to the first TU in source order that reaches it, however the TUs
+// are scheduled: its argumentVariables come from that TU's globals.
+class FunctionRegistry {
+public:
+    // True when no earlier TU (by source index) reached `usr` so far; the
+    // caller then analyzes it. A later TU may have analyzed it already and
+    // loses it to `tu`.
+    bool claim(llvm::StringRef usr, size_t tu) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto [it, inserted] = _owners.try_emplace(usr, tu);
+        if (!inserted && it->second < tu) {
+            return false;
+        }
+        it->second = tu;
+        return true;
+    }
+
+    // Final once every TU before `tu` finished.
+    bool owns(llvm::StringRef usr, size_t tu) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _owners.find(usr);
+        return it != _owners.end() && it->second == tu;
+    }
+
+private:
+    std::mutex _mutex;
+    llvm::StringMap<size_t> _owners;
+};
+
+// Which function bodies the parser may skip (-fast-parse).
+enum class BodySkipping {
+    None,
+    All,
+    OutsideMainFile,
+};
+
+// Per-TU state that lives next to the results rather than inside a visitor.
+// The frontend actions hand it the CompilerInstance and their consumer
+// before parsing starts.
+struct TUContext {
+    bool recordDependencies = false;
+    // Absolute paths of every non-system file the preprocessor entered,
+    // including the main file, in the order they were first entered.
+    std::vector<std::string> dependencies;
+
+    BodySkipping skipBodies = BodySkipping::None;
+    unsigned skippedBodies = 0;
+
+    // Match argumentVariables through typedefs, cv-qualifiers and references.
+    bool canonicalGlobalTypes = false;
+    // Rules for the function "type" label; null means the built-in rules.
+    const SignatureClassifier *classifier = nullptr;
+
+    // Functions defined outside the main file are skipped when an earlier
+    // TU claimed their USR; null analyzes every definition.
+    FunctionRegistry *functions = nullptr;
+    // The TU's position in the source list, which orders the claims.
+    size_t index = 0;
+    // What was skipped: (index into the TU's functions the definition came
+    // before, USR).
+    std::vector<std::pair<size_t, std::string>> skippedFunctions;
+
+    // Parse on top of a PCH of this preamble's header (-preamble); null
+    // parses everything from source.
+    Preamble *preamble = nullptr;
+    // Set once the PCH is on the command line: the header it was built
+    // from, which the main file's first #include must name.
+    std::string preambleHeader;
+    bool preambleMatched = false;
+    std::string preambleError;
+
+    // Files besides the main file whose top-level declarations the variable
+    // and test visitors walk (absolute paths).
+    std::vector<std::string> traversalFiles;
+
+    // Serialize the AST into `ast` once the TU parsed without errors
+    // (-ast-cache).
+    bool serializeAst = false;
+    llvm::SmallString<0> ast;
+
+    // Reserve VariableVisitor's caches from the TU's decl counts.
+    bool presizeCaches = false;
+
+    // Phase timings and counters (--stats); null when not collected.
+    TUStats *stats = nullptr;
+
+    // Time and memory the TU may take (-tu-timeout, -tu-memory-mb); null
+    // when unlimited.
+    TUBudget *budget = nullptr;
+
+    std::unique_ptr<ASTConsumer> attach(CompilerInstance &CI, std::unique_ptr<ASTConsumer> consumer);
+};
+
+class DependencyRecorder : public PPCallbacks {
+public:
+    DependencyRecorder(SourceManager &SM, std::vector<std::string> &dependencies)
+        : SM(SM), _dependencies(dependencies) {}
+
+    void FileChanged(SourceLocation Loc, FileChangeReason Reason, SrcMgr::CharacteristicKind FileType,
+                     FileID) override {
+        if (Reason != EnterFile || FileType != SrcMgr::C_User) {
+            return;
+        }
+        OptionalFileEntryRef FE = SM.getFileEntryRefForID(SM.getFileID(Loc));
+        if (!FE) {
+            return;
+        }
+
+        llvm::SmallString<256> Path(FE->getName());
+        SM.getFileManager().makeAbsolutePath(Path);
+        llvm::sys::path::remove_dots(Path, true);
+        if (_seen.insert(Path).second) {
+            _dependencies.push_back(std::string(Path));
+        }
+    }
+
+private:
+    SourceManager &SM;
+    std::vector<std::string> &_dependencies;
+    llvm::StringSet<> _seen;
+};
+
+// On top of a PCH, the main file's first #include must resolve to the
+// header the PCH was built from, whose include guard then skips it. Any
+// other include, or entering the header again, means the parse is not the
+// one the source asks for.
+class PreambleCheck : public PPCallbacks {
+public:
+    PreambleCheck(SourceManager &SM, OptionalFileEntryRef header, bool &matched)
+        : SM(SM), _header(header), _matched(matched) {}
+
+    void FileChanged(SourceLocation Loc, FileChangeReason Reason, SrcMgr::CharacteristicKind, FileID) override {
+        if (Reason != EnterFile) {
+            return;
+        }
+        FileID FID = SM.getFileID(Loc);
+        if (SM.getFileEntryRefForID(FID) && includedFromMainFile(SM.getIncludeLoc(FID))) {
+            decide(false);
+        }
+    }
+
+    void FileSkipped(const FileEntryRef &SkippedFile, const Token &FilenameTok, SrcMgr::CharacteristicKind) override {
+        if (includedFromMainFile(FilenameTok.getLocation())) {
+            decide(_header && &SkippedFile.getFileEntry() == &_header->getFileEntry());
+        }
+    }
+
+private:
+    SourceManager &SM;
+    OptionalFileEntryRef _header;
+    bool &_matched;
+    bool _decided = false;
+
+    bool includedFromMainFile(SourceLocation Loc) const {
+        return Loc.isValid() && SM.isWrittenInMainFile(SM.getExpansionLoc(Loc));
+    }
+
+    void decide(bool matched) {
+        if (!_decided) {
+            _decided = true;
+            _matched = matched;
+        }
+    }
+};
+
+// The body that follows a function's declarator, found in the raw tokens:
+// the parser has not built it yet, or skipped it.
+struct RawFunctionBody {
+    // The closing brace of the body, or of the last handler of a
+    // function-try-block; invalid when there is no body to find.
+    SourceLocation end;
+    // "class", "struct" or "union" is written inside.
+    bool definesClass = false;
+};
+
+inline RawFunctionBody scanFunctionBody(const SourceManager &SM, const LangOptions &LangOpts,
+                                        const FunctionDecl *FD) {
+    RawFunctionBody Body;
+    SourceLocation DeclEnd = FD->getEndLoc();
+    if (DeclEnd.isInvalid() || DeclEnd.isMacroID()) {
+        return Body;
+    }
+
+    std::pair<FileID, unsigned> LocInfo = SM.getDecomposedLoc(DeclEnd);
+    bool Invalid = false;
+    llvm::StringRef Buffer = SM.getBufferData(LocInfo.first, &Invalid);
+    if (Invalid) {
+        return Body;
+    }
+    Lexer Lex(SM.getLocForStartOfFile(LocInfo.first), LangOpts, Buffer.begin(), Buffer.begin() + LocInfo.second,
+              Buffer.end());
+
+    Token Tok;
+    Lex.LexFromRawLexer(Tok); // the last token of the declarator
+
+    // Skips a balanced group whose opening token is in Tok.
+    auto skipGroup = [&](tok::TokenKind Open, tok::TokenKind Close) {
+        int Depth = 0;
+        do {
+            if (Tok.is(Open)) ++Depth;
+            else if (Tok.is(Close)) --Depth;
+            else if (Tok.is(tok::raw_identifier) && Open == tok::l_brace) {
+                llvm::StringRef Word = Tok.getRawIdentifier();
+                Body.definesClass = Body.definesClass || Word == "class" || Word == "struct" || Word == "union";
+            }
+            if (Depth == 0) return true;
+        } while (!Lex.LexFromRawLexer(Tok) || !Tok.is(tok::eof));
+        return false;
+    };
+
+    bool InInitializers = false;
+    int Parens = 0;
+    Token Prev = Tok;
+    while (!Lex.LexFromRawLexer(Tok) || !Tok.is(tok::eof)) {
+        if (Tok.isOneOf(tok::l_paren, tok::l_square)) {
+            ++Parens;
+        } else if (Tok.isOneOf(tok::r_paren, tok::r_square)) {
+            --Parens;
+        } else if (Parens == 0 && Tok.is(tok::colon) && llvm::isa<CXXConstructorDecl>(FD)) {
+            InInitializers = true;
+        } else if (Parens == 0 && Tok.is(tok::semi)) {
+            return Body;
+        } else if (Parens == 0 && Tok.is(tok::l_brace)) {
+            // In a ctor-initializer, "member{...}" and "Base<T>{...}" are
+            // brace initializers rather than the body.
+            if (InInitializers && Prev.isOneOf(tok::raw_identifier, tok::greater)) {
+                if (!skipGroup(tok::l_brace, tok::r_brace)) return Body;
+                Prev = Tok;
+                continue;
+            }
+            if (!skipGroup(tok::l_brace, tok::r_brace)) return Body;
+            Body.end = Tok.getLocation();
+
+            // A function-try-block ends with its last handler.
+            while (!Lex.LexFromRawLexer(Tok) && Tok.is(tok::raw_identifier) && Tok.getRawIdentifier() == "catch") {
+                Lex.LexFromRawLexer(Tok);
+                if (!skipGroup(tok::l_paren, tok::r_paren)) return Body;
+                Lex.LexFromRawLexer(Tok);
+                if (!skipGroup(tok::l_brace, tok::r_brace)) return Body;
+                Body.end = Tok.getLocation();
+            }
+            return Body;
+        }
+        Prev = Tok;
+    }
+    return Body;
+}
+
+// Sema asks the consumer before skipping a body; constexpr functions and
+// deduced return types are never skipped regardless of the answer. Bodies
+// that define a local class are kept too: the class's member functions are
+// only declared once the body is parsed.
+class BodySkippingConsumer : public ASTConsumer {
+public:
+    BodySkippingConsumer(SourceManager &SM, const LangOptions &LangOpts, BodySkipping policy, unsigned &skipped)
+        : SM(SM), LangOpts(LangOpts), _policy(policy), _skipped(skipped) {}
+
+    bool shouldSkipFunctionBody(Decl *D) override {
+        bool skip = _policy == BodySkipping::All || !SM.isInMainFile(D->getLocation());
+        if (skip) {
+            const FunctionDecl *FD = D->getAsFunction();
+            RawFunctionBody Body;
+            if (FD) {
+                Body = scanFunctionBody(SM, LangOpts, FD);
+            }
+            skip = Body.end.isValid() && !Body.definesClass;
+        }
+        if (skip) {
+            ++_skipped;
+        }
+        return skip;
+    }
+
+private:
+    SourceManager &SM;
+    const LangOptions &LangOpts;
+    BodySkipping _policy;
+    unsigned &_skipped;
+};
+
+// Writes the TU's AST in the format ASTUnit::LoadFromASTFile() reads, as
+// `clang -emit-ast` would. A TU with errors is not written: loading it
+// would need AllowASTWithCompilerErrors and a half-built AST.
+class AstSerializer : public SemaConsumer {
+public:
+    AstSerializer(llvm::SmallString<0> &output, TUStats *stats) : _output(output), _stats(stats) {}
+
+    void InitializeSema(Sema &S) override { _sema = &S; }
+    void ForgetSema() override { _sema = nullptr; }
+
+    void HandleTranslationUnit(ASTContext &) override {
+        if (!_sema || _sema->getDiagnostics().hasErrorOccurred()) {
+            return;
+        }
+        if (_stats) {
+            _stats->beginPhase("ast_serialize");
+        }
+        llvm::BitstreamWriter Stream(_output);
+        InMemoryModuleCache ModuleCache;
+        ASTWriter Writer(Stream, _output, ModuleCache, {});
+        Writer.WriteAST(*_sema, std::string(), nullptr, "");
+    }
+
+private:
+    llvm::SmallString<0> &_output;
+    TUStats *_stats;
+    Sema *_sema = nullptr;
+};
+
+// Counts the nodes the analysis visitors can see, under the same traversal
+// policy (no template instantiations, no implicit code).
+class NodeCounter : public RecursiveASTVisitor<NodeCounter> {
+public:
+    explicit NodeCounter(TUStats &stats) : _stats(stats) {}
+
+    bool VisitDecl(Decl *) {
+        ++_stats.decls;
+        return true;
+    }
+
+    bool VisitStmt(Stmt *) {
+        ++_stats.stmts;
+        return true;
+    }
+
+private:
+    TUStats &_stats;
+};
+
+// Placed before and after the analysis consumer in a MultiplexConsumer,
+// which calls HandleTranslationUnit in order, to split parsing from the
+// visitors' walk.
+class PhaseProbe : public ASTConsumer {
+public:
+    enum Position {
+        BeforeAnalysis,
+        AfterAnalysis,
+    };
+
+    PhaseProbe(TUStats &stats, Position position) : _stats(stats), _position(position) {}
+
+    void HandleTranslationUnit(ASTContext &Context) override {
+        if (_position == BeforeAnalysis) {
+            _stats.beginPhase("traverse");
+            return;
+        }
+        _stats.beginPhase("count");
+        NodeCounter(_stats).TraverseDecl(Context.getTranslationUnitDecl());
+        _stats.beginPhase("teardown");
+    }
+
+private:
+    TUStats &_stats;
+    Position _position;
+};
+
+inline std::unique_ptr<ASTConsumer> TUContext::attach(CompilerInstance &CI, std::unique_ptr<ASTConsumer> consumer) {
+    if (recordDependencies) {
+        CI.getPreprocessor().addPPCallbacks(
+            std::make_unique<DependencyRecorder>(CI.getSourceManager(), dependencies));
+    }
+    if (!preambleHeader.empty()) {
+        CI.getPreprocessor().addPPCallbacks(std::make_unique<PreambleCheck>(
+            CI.getSourceManager(), CI.getFileManager().getOptionalFileRef(preambleHeader), preambleMatched));
+    }
+
+    std::vector<std::unique_ptr<ASTConsumer>> consumers;
+    if (budget) {
+        budget->track(CI.getASTContext(), &CI.getPreprocessor());
+        consumers.push_back(std::make_unique<BudgetConsumer>(*budget, CI.getDiagnostics()));
+        CI.getPreprocessor().addPPCallbacks(std::make_unique<BudgetPPCallbacks>(*budget, CI.getDiagnostics()));
+    }
+    if (stats) {
+        stats->beginPhase("parse");
+        consumers.push_back(std::make_unique<PhaseProbe>(*stats, PhaseProbe::BeforeAnalysis));
+    }
+    consumers.push_back(std::move(consumer));
+    if (serializeAst) {
+        consumers.push_back(std::make_unique<AstSerializer>(ast, stats));
+    }
+    if (stats) {
+        consumers.push_back(std::make_unique<PhaseProbe>(*stats, PhaseProbe::AfterAnalysis));
+    }
+
+    if (skipBodies != BodySkipping::None) {
+        CI.getFrontendOpts().SkipFunctionBodies = true;
+        // MultiplexConsumer only skips a body when every consumer agrees, and
+        // the analysis consumers keep ASTConsumer's default of "yes".
+        consumers.push_back(std::make_unique<BodySkippingConsumer>(CI.getSourceManager(), CI.getLangOpts(),
+                                                                   skipBodies, skippedBodies));
+    }
+
+    if (consumers.size() == 1) {
+        return std::move(consumers.front());
+    }
+    return std::make_unique<MultiplexConsumer>(std::move(consumers));
+}
+
+#endif
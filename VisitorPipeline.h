@@ -0,0 +1,261 @@
+#ifndef VISITOR_PIPELINE_H
+#define VISITOR_PIPELINE_H
+
+#include "TUBudget.h"
+
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/Path.h>
+#include <array>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace clang;
+
+// Traversal hooks a visitor exposes so that FusedVisitor can reproduce its
+// custom Traverse* overrides. The defaults describe a plain visitor.
+class VisitorStage {
+public:
+    // Return false to keep this stage out of the subtree rooted at the node.
+    bool shouldTraverseDecl(Decl *) { return true; }
+    bool shouldTraverseStmt(Stmt *) { return true; }
+
+    // Bracket the traversal of a declaration's subtree.
+    void enterDecl(Decl *) {}
+    void leaveDecl(Decl *) {}
+};
+
+// Walks the AST once and feeds every node to each stage exactly as that
+// stage's own TraverseDecl would, so results do not change, but the tree
+// is only walked a single time. Stages must share the default traversal
+// policy (no template instantiations, no implicit code, pre-order).
+template <typename... Stages>
+class FusedVisitor : public RecursiveASTVisitor<FusedVisitor<Stages...>> {
+    using Base = RecursiveASTVisitor<FusedVisitor<Stages...>>;
+    static constexpr size_t StageCount = sizeof...(Stages);
+
+public:
+    explicit FusedVisitor(Stages &...stages) : _stages(stages...) {
+        _active.fill(true);
+    }
+
+    // Abandon the walk, returning false, once `budget` is exceeded.
+    void setBudget(TUBudget *budget) { _budget = budget; }
+
+    bool TraverseDecl(Decl *D) {
+        if (!D) {
+            return true;
+        }
+        if (_budget && _budget->exceeded()) {
+            return false;
+        }
+
+        std::array<bool, StageCount> wasActive = _active;
+        forEachStage([&](auto &stage, size_t i) {
+            if (!_active[i]) return;
+            if (stage.shouldTraverseDecl(D)) {
+                stage.enterDecl(D);
+            } else {
+                _active[i] = false;
+            }
+        });
+
+        bool result = anyActive(_active) ? Base::TraverseDecl(D) : true;
+
+        forEachStage([&](auto &stage, size_t i) {
+            if (_active[i]) stage.leaveDecl(D);
+        });
+        _active = wasActive;
+        return result;
+    }
+
+    // Statements go through RecursiveASTVisitor's data recursion queue, so
+    // deep expression chains do not nest native frames. The queue brackets
+    // each statement's subtree with these two hooks; a stage deactivated in
+    // Pre is restored in Post. Over budget, every remaining statement is
+    // skipped and the next TraverseDecl abandons the walk.
+    bool dataTraverseStmtPre(Stmt *S) {
+        if (_budget && _budget->exceeded()) {
+            return false;
+        }
+
+        std::array<bool, StageCount> active = _active;
+        forEachStage([&](auto &stage, size_t i) {
+            if (active[i] && !stage.shouldTraverseStmt(S)) active[i] = false;
+        });
+        if (!anyActive(active)) {
+            return false;
+        }
+        _saved.push_back(_active);
+        _active = active;
+        return true;
+    }
+
+    bool dataTraverseStmtPost(Stmt *) {
+        _active = _saved.pop_back_val();
+        return true;
+    }
+
+    bool VisitDecl(Decl *D) {
+        bool result = true;
+        forEachStage([&](auto &stage, size_t i) {
+            if (_active[i]) result &= walkUpFrom(stage, D);
+        });
+        return result;
+    }
+
+    bool VisitStmt(Stmt *S) {
+        bool result = true;
+        forEachStage([&](auto &stage, size_t i) {
+            if (_active[i]) result &= walkUpFrom(stage, S);
+        });
+        return result;
+    }
+
+private:
+    std::tuple<Stages &...> _stages;
+    std::array<bool, StageCount> _active;
+    // The activation of each enclosing statement being traversed.
+    llvm::SmallVector<std::array<bool, StageCount>, 32> _saved;
+    TUBudget *_budget = nullptr;
+
+    template <typename F>
+    void forEachStage(F &&f) {
+        forEachStage(std::forward<F>(f), std::index_sequence_for<Stages...>());
+    }
+
+    template <typename F, size_t... I>
+    void forEachStage(F &&f, std::index_sequence<I...>) {
+        (f(std::get<I>(_stages), I), ...);
+    }
+
+    static bool anyActive(const std::array<bool, StageCount> &stages) {
+        for (bool active : stages) {
+            if (active) return true;
+        }
+        return false;
+    }
+
+    // Runs the stage's Visit* chain for the node's dynamic class, the same
+    // dispatch RecursiveASTVisitor performs in its own TraverseDecl/Stmt.
+    template <typename Stage>
+    static bool walkUpFrom(Stage &stage, Decl *D) {
+        switch (D->getKind()) {
+#define ABSTRACT_DECL(DECL)
+#define DECL(CLASS, BASE) \
+        case Decl::CLASS: \
+            return stage.WalkUpFrom##CLASS##Decl(static_cast<CLASS##Decl *>(D));
+#include <clang/AST/DeclNodes.inc>
+        }
+        return true;
+    }
+
+    template <typename Stage>
+    static bool walkUpFrom(Stage &stage, Stmt *S) {
+        switch (S->getStmtClass()) {
+        case Stmt::NoStmtClass:
+            break;
+#define ABSTRACT_STMT(STMT)
+#define STMT(CLASS, PARENT) \
+        case Stmt::CLASS##Class: \
+            return stage.WalkUpFrom##CLASS(static_cast<CLASS *>(S));
+#include <clang/AST/StmtNodes.inc>
+        }
+        return true;
+    }
+};
+
+// The part of a TU the main-file stages (VariableVisitor, TestVisitor)
+// walk: top-level declarations whose expansion location is in the main
+// file or in one of `files` (absolute paths). Nothing they report comes
+// from elsewhere, so the subtrees of header declarations are never
+// entered.
+class TraversalScope {
+public:
+    explicit TraversalScope(SourceManager &SM, const std::vector<std::string> *files = nullptr) : SM(SM) {
+        if (files) {
+            for (const auto &file : *files) {
+                _files.insert(file);
+            }
+        }
+    }
+
+    // The in-scope children of the TU, in the order RecursiveASTVisitor
+    // would traverse them. Declarations loaded from a PCH can only belong
+    // to headers, so unless other files are in scope they are not even
+    // deserialized. In an AST loaded from -ast-cache the main file is
+    // external as well, so everything is.
+    std::vector<Decl *> topLevelDecls(TranslationUnitDecl *TU, uint64_t *skipped = nullptr) {
+        std::vector<Decl *> decls;
+        auto collect = [&](Decl *D) {
+            if (isTraversedWithParent(D)) {
+                return;
+            }
+            if (contains(D)) {
+                decls.push_back(D);
+            } else if (skipped) {
+                ++*skipped;
+            }
+        };
+        if (_files.empty() && !SM.isLoadedFileID(SM.getMainFileID())) {
+            for (Decl *D : TU->noload_decls()) collect(D);
+        } else {
+            for (Decl *D : TU->decls()) collect(D);
+        }
+        return decls;
+    }
+
+    // For a stage that shares a walk of the whole TU: false for top-level
+    // declarations out of scope. Nested declarations follow their parent.
+    bool allows(Decl *D) {
+        DeclContext *DC = D->getLexicalDeclContext();
+        return !DC || !isa<TranslationUnitDecl>(DC) || contains(D);
+    }
+
+private:
+    SourceManager &SM;
+    llvm::StringSet<> _files;
+    llvm::DenseMap<FileID, bool> _inScope;
+
+    bool contains(Decl *D) {
+        SourceLocation Loc = SM.getExpansionLoc(D->getLocation());
+        if (Loc.isInvalid()) {
+            return false;
+        }
+        FileID FID = SM.getFileID(Loc);
+        if (FID == SM.getMainFileID()) {
+            return true;
+        }
+        if (_files.empty()) {
+            return false;
+        }
+        auto [it, inserted] = _inScope.try_emplace(FID, false);
+        if (inserted) {
+            if (OptionalFileEntryRef FE = SM.getFileEntryRefForID(FID)) {
+                llvm::SmallString<256> Path(FE->getName());
+                SM.getFileManager().makeAbsolutePath(Path);
+                llvm::sys::path::remove_dots(Path, true);
+                it->second = _files.contains(Path);
+            }
+        }
+        return it->second;
+    }
+
+    // Children RecursiveASTVisitor leaves to the expression that owns them.
+    static bool isTraversedWithParent(Decl *D) {
+        if (isa<BlockDecl>(D) || isa<CapturedDecl>(D)) {
+            return true;
+        }
+        auto *RD = dyn_cast<CXXRecordDecl>(D);
+        return RD && RD->isLambda();
+    }
+};
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef WATCH_MODE_H
+#define WATCH_MODE_H
+
+#include "AnalysisRunner.h"
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+// -watch: analyzes every source once, then keeps the per-TU results and
+// re-analyzes only the TUs whose main file or non-system includes changed.
+//
+// Output is one JSON line per event on stdout:
+//   {"event": "initial", "result": <the usual json document>}
+//   {"event": "update", "files": [{"file": ..., <per-TU result>}, ...],
+//    "can_test": <merged value over all TUs>}
+// An update lists only the re-analyzed TUs; each entry replaces everything
+// earlier events reported for that file.
+//
+// Directories rather than files are watched, so editors that save by
+// writing a new file and renaming it over the old one are still seen.
+// A TU whose parse failed may be missing a header, which its dependency
+// list cannot name: it is re-analyzed whenever a file or directory appears
+// in any watched directory, and the include directories of its compile
+// command are watched too.
+class WatchSession {
+public:
+    WatchSession(const tooling::CompilationDatabase &db, std::vector<std::string> files, AnalysisOptions options,
+                 unsigned jobs)
+        : _db(db), _files(std::move(files)), _options(std::move(options)), _jobs(jobs) {
+        _options.recordDependencies = true;
+        _options.dedupFunctions = false;
+    }
+
+    ~WatchSession() {
+        if (_inotify >= 0) {
+            close(_inotify);
+        }
+    }
+
+    int run() {
+        _inotify = inotify_init1(IN_CLOEXEC);
+        if (_inotify < 0) {
+            std::cerr << "inotify_init1: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+
+        _results = analyzeAll(_db, _files, _options, _jobs);
+        reindex();
+        emit(json{{"event", "initial"}, {"result", mergeResults(_results, _options.mode)}});
+
+        while (true) {
+            std::set<size_t> dirty;
+            if (!waitForChanges(dirty)) {
+                return 1;
+            }
+            if (!dirty.empty()) {
+                update(dirty);
+            }
+        }
+    }
+
+private:
+    // Events closer together than this are handled as one edit.
+    static constexpr int QuietMs = 50;
+
+    const tooling::CompilationDatabase &_db;
+    std::vector<std::string> _files;
+    AnalysisOptions _options;
+    unsigned _jobs;
+
+    std::vector<TUResult> _results;
+    int _inotify = -1;
+    llvm::DenseMap<int, std::string> _watchedDirectories;
+    llvm::StringMap<int> _watches;
+    // Absolute file path -> indices of the TUs that read it.
+    llvm::StringMap<std::vector<size_t>> _dependents;
+    // TUs whose last parse failed.
+    std::vector<size_t> _failed;
+
+    static std::string absolutePath(llvm::StringRef path) {
+        llvm::SmallString<256> Path(path);
+        llvm::sys::fs::make_absolute(Path);
+        llvm::sys::path::remove_dots(Path, true);
+        return std::string(Path);
+    }
+
+    void reindex() {
+        _dependents.clear();
+        _failed.clear();
+        for (size_t i = 0; i < _results.size(); ++i) {
+            if (_results[i].parseFailed) {
+                _failed.push_back(i);
+                for (const auto &directory : includeDirectories(i)) {
+                    watchDirectory(directory);
+                }
+            }
+            // The main file is listed even when the parse never entered it.
+            std::vector<std::string> paths = _results[i].dependencies;
+            paths.push_back(absolutePath(_files[i]));
+            for (const auto &path : paths) {
+                std::vector<size_t> &dependents = _dependents[path];
+                if (dependents.empty() || dependents.back() != i) {
+                    dependents.push_back(i);
+                }
+                watchDirectory(llvm::sys::path::parent_path(path));
+            }
+        }
+    }
+
+    // The -I, -iquote, -idirafter and -isystem directories the TU searches.
+    std::vector<std::string> includeDirectories(size_t i) const {
+        static const llvm::StringRef Flags[] = {"-I", "-iquote", "-idirafter", "-isystem"};
+
+        std::vector<std::string> directories;
+        for (const auto &Command : _db.getCompileCommands(absolutePath(_files[i]))) {
+            std::vector<std::string> args = Command.CommandLine;
+            args.insert(args.end(), _options.extraArgs.begin(), _options.extraArgs.end());
+            for (size_t a = 0; a < args.size(); ++a) {
+                llvm::StringRef Arg = args[a];
+                for (llvm::StringRef Flag : Flags) {
+                    if (!Arg.starts_with(Flag)) continue;
+                    llvm::StringRef Directory = Arg.drop_front(Flag.size());
+                    if (Directory.empty() && a + 1 < args.size()) {
+                        Directory = args[++a];
+                    }
+                    llvm::SmallString<256> Path(Directory);
+                    if (!Path.empty() && !llvm::sys::path::is_absolute(Path)) {
+                        Path = Command.Directory;
+                        llvm::sys::path::append(Path, Directory);
+                    }
+                    if (!Path.empty()) {
+                        directories.push_back(absolutePath(Path));
+                    }
+                    break;
+                }
+            }
+        }
+        return directories;
+    }
+
+    void watchDirectory(llvm::StringRef directory) {
+        if (directory.empty() || _watches.count(directory)) {
+            return;
+        }
+        int wd = inotify_add_watch(_inotify, directory.str().c_str(),
+                                   IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM);
+        if (wd < 0) {
+            std::cerr << "inotify_add_watch " << directory.str() << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        _watches[directory] = wd;
+        _watchedDirectories[wd] = directory.str();
+    }
+
+    // Blocks for the first event, then keeps collecting until the watched
+    // tree has been quiet for QuietMs. Returns false on an inotify error.
+    bool waitForChanges(std::set<size_t> &dirty) {
+        int timeout = -1;
+        while (true) {
+            pollfd fd{_inotify, POLLIN, 0};
+            int ready = poll(&fd, 1, timeout);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "poll: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            if (ready == 0) {
+                return true;
+            }
+
+            alignas(inotify_event) char buffer[16 * 1024];
+            ssize_t length = read(_inotify, buffer, sizeof(buffer));
+            if (length < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                std::cerr << "read inotify: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+
+            for (char *p = buffer; p < buffer + length;) {
+                const auto *event = reinterpret_cast<const inotify_event *>(p);
+                p += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // Events were lost; any TU may be stale.
+                    for (size_t i = 0; i < _files.size(); ++i) {
+                        dirty.insert(i);
+                    }
+                    continue;
+                }
+                auto directory = _watchedDirectories.find(event->wd);
+                if (directory == _watchedDirectories.end() || event->len == 0) {
+                    continue;
+                }
+                llvm::SmallString<256> Path(directory->second);
+                llvm::sys::path::append(Path, event->name);
+                auto dependents = _dependents.find(Path);
+                if (dependents != _dependents.end()) {
+                    dirty.insert(dependents->second.begin(), dependents->second.end());
+                }
+                if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !_failed.empty()) {
+                    dirty.insert(_failed.begin(), _failed.end());
+                    // The missing header may be created inside it next.
+                    if (event->mask & IN_ISDIR) {
+                        watchDirectory(Path);
+                    }
+                }
+            }
+            timeout = QuietMs;
+        }
+    }
+
+    void update(const std::set<size_t> &dirty) {
+        std::vector<size_t> indices(dirty.begin(), dirty.end());
+        std::vector<std::string> files;
+        for (size_t i : indices) {
+            files.push_back(_files[i]);
+        }
+        analyzeAll(_db, files, _options, _jobs,
+                   [&](size_t index, TUResult &result) { _results[indices[index]] = std::move(result); });
+        reindex();
+
+        json changed = json::array();
+        for (size_t i : indices) {
+            json entry = _results[i];
+            entry["file"] = _files[i];
+            changed.push_back(std::move(entry));
+        }
+        json event{{"event", "update"}, {"files", std::move(changed)}};
+        if (_options.mode == Variables || _options.mode == All) {
+            bool canTest = false;
+            for (const auto &tu : _results) {
+                canTest = canTest || tu.canTest;
+            }
+            event["can_test"] = canTest;
+        }
+        emit(event);
+    }
+
+    static void emit(const json &event) {
+        std::cout << event.dump() << std::endl;
+    }
+};
+
+#endif
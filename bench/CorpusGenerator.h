@@ -0,0 +1,222 @@
+#ifndef CORPUS_GENERATOR_H
+#define CORPUS_GENERATOR_H
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// Size of a synthetic corpus. Counts other than tus and headerClasses are
+// per translation unit.
+struct CorpusShape {
+    unsigned tus = 8;
+    // Cycles through the signature shapes of the built-in classifier rules
+    // (array, text, matrix, image, audio, video) plus one that matches none.
+    unsigned functions = 70;
+    unsigned globals = 40;
+    // Enum parameters appended to each function, where the shape has room.
+    unsigned enumParams = 1;
+    // scanf / std::cin >> statements in main, alternating.
+    unsigned inputSites = 40;
+    // DataImage / DataArray constructions in main, alternating.
+    unsigned constructors = 20;
+    // Class templates in the shared mock framework header, each explicitly
+    // instantiated, so every TU pays a realistic header cost.
+    unsigned headerClasses = 300;
+};
+
+class CorpusGenerator {
+public:
+    explicit CorpusGenerator(CorpusShape shape) : _shape(shape) {}
+
+    // Writes framework.h, tu_<n>.cpp and compile_commands.json into
+    // `directory` and returns the absolute paths of the sources.
+    bool generate(const std::string &directory, std::vector<std::string> &sources, std::string &error) const {
+        llvm::SmallString<256> Root(directory);
+        llvm::sys::fs::make_absolute(Root);
+        if (std::error_code EC = llvm::sys::fs::create_directories(Root)) {
+            error = "cannot create " + std::string(Root) + ": " + EC.message();
+            return false;
+        }
+
+        if (!writeFile(Root, "framework.h", frameworkHeader(), error)) {
+            return false;
+        }
+
+        json commands = json::array();
+        for (unsigned tu = 0; tu < _shape.tus; ++tu) {
+            std::string name = "tu_" + std::to_string(tu) + ".cpp";
+            if (!writeFile(Root, name, translationUnit(tu), error)) {
+                return false;
+            }
+            llvm::SmallString<256> Path(Root);
+            llvm::sys::path::append(Path, name);
+            sources.push_back(std::string(Path));
+            commands.push_back({
+                {"directory", std::string(Root)},
+                {"file", std::string(Path)},
+                {"arguments", json::array({"clang++", "-std=c++17", "-fsyntax-only", std::string(Path)})}
+            });
+        }
+        return writeFile(Root, "compile_commands.json", commands.dump(2), error);
+    }
+
+private:
+    CorpusShape _shape;
+
+    static bool writeFile(llvm::StringRef directory, llvm::StringRef name, const std::string &contents,
+                          std::string &error) {
+        llvm::SmallString<256> Path(directory);
+        llvm::sys::path::append(Path, name);
+        std::error_code EC;
+        llvm::raw_fd_ostream OS(Path, EC);
+        if (EC) {
+            error = "cannot write " + std::string(Path) + ": " + EC.message();
+            return false;
+        }
+        OS << contents;
+        return true;
+    }
+
+    std::string frameworkHeader() const {
+        std::string out =
+            "#pragma once\n"
+            "#include <cstddef>\n"
+            "#include <cstdio>\n"
+            "#include <iostream>\n"
+            "#include <map>\n"
+            "#include <string>\n"
+            "#include <vector>\n"
+            "\n"
+            "struct RGBImage { unsigned char r, g, b; };\n"
+            "struct VideoFrame { int width, height; };\n"
+            "struct AudioFrame { int rate; };\n"
+            "struct AudioBuffer { float *samples; size_t size; };\n"
+            "enum Mode { Fast, Balanced, Precise };\n"
+            "enum class Channel { Left, Right, Both };\n"
+            "\n"
+            "class TestOptions { public: int repetitions = 1; };\n"
+            "class FunctionManager { public: template <typename F> void add(const char *name, F f) {} };\n"
+            "class DataManager { public: void load(const std::string &path) {} };\n"
+            "class TestFunctions {\n"
+            "public:\n"
+            "    TestFunctions(FunctionManager &functions, DataManager &data, TestOptions &options) {}\n"
+            "    void run() {}\n"
+            "};\n"
+            "class DataImage { public: explicit DataImage(const char *path) {} };\n"
+            "class DataArray { public: explicit DataArray(const char *path) {} };\n"
+            "\n"
+            "namespace mock {\n";
+        for (unsigned i = 0; i < _shape.headerClasses; ++i) {
+            std::string name = "Component" + std::to_string(i);
+            out += "template <typename T>\n"
+                   "class " + name + " {\n"
+                   "public:\n"
+                   "    T get() const { return _value; }\n"
+                   "    void set(const T &value) { _value = value; _history.push_back(value); }\n"
+                   "    std::map<int, T> index() const {\n"
+                   "        std::map<int, T> result;\n"
+                   "        for (size_t i = 0; i < _history.size(); ++i) result[static_cast<int>(i)] = _history[i];\n"
+                   "        return result;\n"
+                   "    }\n"
+                   "private:\n"
+                   "    T _value{};\n"
+                   "    std::vector<T> _history;\n"
+                   "};\n"
+                   "template class " + name + (i % 2 ? "<double>" : "<int>") + ";\n";
+        }
+        out += "} // namespace mock\n";
+        return out;
+    }
+
+    std::string enumParams(unsigned room) const {
+        std::string out;
+        for (unsigned i = 0; i < std::min(room, _shape.enumParams); ++i) {
+            out += i % 2 ? ", Channel channel" + std::to_string(i) : ", Mode mode" + std::to_string(i);
+        }
+        return out;
+    }
+
+    std::string function(unsigned tu, unsigned index) const {
+        std::string suffix = std::to_string(tu) + "_" + std::to_string(index);
+        switch (index % 7) {
+        case 0:
+            return "void sort_" + suffix + "(int *data, size_t size" + enumParams(1) + ") {\n"
+                   "    for (size_t i = 1; i < size; ++i)\n"
+                   "        for (size_t j = i; j > 0 && data[j - 1] > data[j]; --j) std::swap(data[j - 1], data[j]);\n"
+                   "}\n";
+        case 1:
+            return "size_t count_" + suffix + "(char *text, size_t size" + enumParams(1) + ") {\n"
+                   "    size_t words = 0;\n"
+                   "    for (size_t i = 0; i < size; ++i) words += text[i] == ' ';\n"
+                   "    return words;\n"
+                   "}\n";
+        case 2:
+            return "double trace_" + suffix + "(double **matrix, size_t rows, size_t cols) {\n"
+                   "    double sum = 0;\n"
+                   "    for (size_t i = 0; i < rows && i < cols; ++i) sum += matrix[i][i];\n"
+                   "    return sum;\n"
+                   "}\n";
+        case 3:
+            return "void invert_" + suffix + "(RGBImage **image, size_t width, size_t height) {\n"
+                   "    for (size_t y = 0; y < height; ++y)\n"
+                   "        for (size_t x = 0; x < width; ++x) image[y][x].r = 255 - image[y][x].r;\n"
+                   "}\n";
+        case 4:
+            return "void gain_" + suffix + "(float *samples, size_t size, int rate, int channels" + enumParams(3) +
+                   ") {\n"
+                   "    for (size_t i = 0; i < size; ++i) samples[i] *= 0.5f * channels / rate;\n"
+                   "}\n";
+        case 5:
+            return "void mux_" + suffix + "(VideoFrame video, AudioFrame audio, size_t width, size_t height, "
+                   "size_t stride, size_t frames, int fps, int quality" + enumParams(_shape.enumParams) + ") {\n"
+                   "    video.width = static_cast<int>(width * height / (stride + frames + 1)) + fps * quality;\n"
+                   "}\n";
+        default:
+            return "int helper_" + suffix + "(int a, double b) {\n"
+                   "    return a + static_cast<int>(b);\n"
+                   "}\n";
+        }
+    }
+
+    std::string translationUnit(unsigned tu) const {
+        static const char *GlobalTypes[] = {"int", "size_t", "double", "Mode", "float *"};
+
+        std::string out = "#include \"framework.h\"\n\n";
+        for (unsigned i = 0; i < _shape.globals; ++i) {
+            out += std::string(GlobalTypes[i % 5]) + " global_" + std::to_string(i) + "{};\n";
+        }
+        out += "\n";
+        for (unsigned i = 0; i < _shape.functions; ++i) {
+            out += function(tu, i) + "\n";
+        }
+
+        out += "int main() {\n"
+               "    TestOptions options;\n"
+               "    FunctionManager functions;\n"
+               "    DataManager data;\n";
+        for (unsigned i = 0; i < _shape.inputSites; ++i) {
+            std::string name = "input_" + std::to_string(i);
+            out += "    int " + name + " = 0;\n";
+            out += i % 2 ? "    std::cin >> " + name + ";\n" : "    scanf(\"%d\", &" + name + ");\n";
+        }
+        for (unsigned i = 0; i < _shape.constructors; ++i) {
+            std::string name = std::to_string(i);
+            out += i % 2 ? "    DataArray array_" + name + "(\"array_" + name + ".txt\");\n"
+                         : "    DataImage image_" + name + "(\"image_" + name + ".png\");\n";
+        }
+        out += "    TestFunctions tests(functions, data, options);\n"
+               "    tests.run();\n"
+               "    return 0;\n"
+               "}\n";
+        return out;
+    }
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "AnalysisRunner.h"
+#include "CompactWriter.h"
+#include "CorpusGenerator.h"
+#include "NdjsonWriter.h"
+#include "VisitorPipeline.h"
+
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Tooling/JSONCompilationDatabase.h>
+#include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static llvm::cl::list<unsigned> Scales("scales", llvm::cl::desc("Translation unit counts to benchmark (default 1,8,32)"),
+                                       llvm::cl::CommaSeparated);
+static llvm::cl::opt<unsigned> Repetitions("repetitions", llvm::cl::desc("Runs per phase; the fastest is reported"),
+                                           llvm::cl::init(3));
+static llvm::cl::opt<unsigned> Functions("functions", llvm::cl::desc("Functions per translation unit"),
+                                         llvm::cl::init(CorpusShape().functions));
+static llvm::cl::opt<unsigned> HeaderClasses("header-classes", llvm::cl::desc("Class templates in framework.h"),
+                                             llvm::cl::init(CorpusShape().headerClasses));
+static llvm::cl::opt<std::string> KeepCorpus("keep-corpus",
+                                             llvm::cl::desc("Generate the corpora under this directory and keep them"),
+                                             llvm::cl::value_desc("dir"));
+
+// Every heap allocation of the process, so each row can report how many
+// one run of its phase made.
+static std::atomic<size_t> Allocations{0};
+static size_t LastRunAllocations = 0;
+
+void *operator new(size_t size) {
+    ++Allocations;
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+template <typename F>
+static double bestOf(unsigned repetitions, F &&run) {
+    double best = std::numeric_limits<double>::max();
+    for (unsigned i = 0; i < std::max(1u, repetitions); ++i) {
+        size_t allocationsBefore = Allocations;
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        LastRunAllocations = Allocations - allocationsBefore;
+    }
+    return best;
+}
+
+class Report {
+public:
+    Report(unsigned tus, unsigned functions) : _tus(tus), _functions(functions) {}
+
+    static void header() {
+        std::cout << std::left << std::setw(8) << "TUs" << std::setw(14) << "phase" << std::right << std::setw(12)
+                  << "ms" << std::setw(12) << "TUs/s" << std::setw(14) << "functions/s" << std::setw(12) << "bytes"
+                  << std::setw(12) << "allocs" << std::endl;
+    }
+
+    void row(const char *phase, double ms, size_t bytes = 0) const {
+        double seconds = ms / 1000;
+        std::cout << std::left << std::setw(8) << _tus << std::setw(14) << phase << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(12) << ms << std::setprecision(1) << std::setw(12)
+                  << _tus / seconds << std::setw(14) << _functions / seconds << std::setw(12);
+        if (bytes) {
+            std::cout << bytes;
+        } else {
+            std::cout << "-";
+        }
+        std::cout << std::setw(12) << LastRunAllocations << std::endl;
+    }
+
+private:
+    unsigned _tus;
+    unsigned _functions;
+};
+
+template <typename Visitor, typename... Outputs>
+static void traverseAll(std::vector<std::unique_ptr<ASTUnit>> &ASTs, Outputs &...outputs) {
+    for (auto &AST : ASTs) {
+        Visitor visitor(AST->getASTContext(), AST->getSourceManager(), outputs...);
+        visitor.TraverseDecl(AST->getASTContext().getTranslationUnitDecl());
+    }
+}
+
+static int benchmarkScale(unsigned tus, const std::string &directory) {
+    CorpusShape shape;
+    shape.tus = tus;
+    shape.functions = Functions;
+    shape.headerClasses = HeaderClasses;
+
+    std::vector<std::string> sources;
+    std::string error;
+    if (!CorpusGenerator(shape).generate(directory, sources, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    llvm::SmallString<256> CommandsPath(directory);
+    llvm::sys::path::append(CommandsPath, "compile_commands.json");
+    auto db = tooling::JSONCompilationDatabase::loadFromFile(CommandsPath, error,
+                                                             tooling::JSONCommandLineSyntax::AutoDetect);
+    if (!db) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    Report report(tus, tus * shape.functions);
+
+    tooling::ClangTool Tool(*db, sources);
+    std::vector<std::unique_ptr<ASTUnit>> ASTs;
+    int status = 0;
+    report.row("parse", bestOf(Repetitions, [&] {
+        ASTs.clear();
+        status = Tool.buildASTs(ASTs);
+    }));
+    if (status != 0 || ASTs.size() != sources.size()) {
+        std::cerr << "failed to parse the generated corpus in " << directory << std::endl;
+        return 1;
+    }
+
+    report.row("variables", bestOf(Repetitions, [&] {
+        Data data;
+        traverseAll<VariableVisitor>(ASTs, data);
+    }));
+    report.row("tests", bestOf(Repetitions, [&] {
+        Strings strings;
+        bool canTest = false;
+        traverseAll<TestVisitor>(ASTs, strings, canTest);
+    }));
+    report.row("functions", bestOf(Repetitions, [&] {
+        FunctionData functions;
+        traverseAll<FunctionVisitor>(ASTs, functions);
+    }));
+
+    std::vector<TUResult> results;
+    report.row("fused", bestOf(Repetitions, [&] {
+        results.assign(ASTs.size(), TUResult());
+        for (size_t i = 0; i < ASTs.size(); ++i) {
+            ASTContext &Context = ASTs[i]->getASTContext();
+            SourceManager &SM = ASTs[i]->getSourceManager();
+            TUResult &result = results[i];
+            result.file = sources[i];
+            VariableVisitor variables(Context, SM, result.variables);
+            TestVisitor tests(Context, SM, result.strings, result.canTest);
+            FunctionVisitor functions(Context, SM, result.functions);
+            FusedVisitor<VariableVisitor, TestVisitor, FunctionVisitor> visitor(variables, tests, functions);
+            visitor.TraverseDecl(Context.getTranslationUnitDecl());
+        }
+    }));
+
+    // What holding the records costs: one copy of every TU's results.
+    report.row("records", bestOf(Repetitions, [&] {
+        std::vector<TUResult> copy(results);
+    }));
+
+    size_t bytes = 0;
+    double ms = bestOf(Repetitions, [&] { bytes = mergeResults(results, All).dump(4).size(); });
+    report.row("json", ms, bytes);
+    ms = bestOf(Repetitions, [&] {
+        std::ostringstream out;
+        NdjsonWriter writer(out, All);
+        for (const auto &result : results) {
+            writer.write(result);
+        }
+        writer.finish();
+        bytes = out.str().size();
+    });
+    report.row("ndjson", ms, bytes);
+    ms = bestOf(Repetitions, [&] { bytes = json::to_cbor(compactDocument(results, All)).size(); });
+    report.row("cbor", ms, bytes);
+    std::cout << "peak RSS " << peakRssKb() << " kB" << std::endl;
+    return 0;
+}
+
+int main(int argc, const char **argv) {
+    llvm::cl::ParseCommandLineOptions(argc, argv,
+                                      "Times parsing, each visitor and serialization on generated corpora\n");
+
+    std::vector<unsigned> scales(Scales.begin(), Scales.end());
+    if (scales.empty()) {
+        scales = {1, 8, 32};
+    }
+
+    Report::header();
+    for (unsigned tus : scales) {
+        llvm::SmallString<256> Directory;
+        if (KeepCorpus.empty()) {
+            llvm::SmallString<256> Prefix;
+            llvm::sys::path::system_temp_directory(/*ErasedOnReboot=*/true, Prefix);
+            llvm::sys::path::append(Prefix, "input-analyzer-bench");
+            if (std::error_code EC = llvm::sys::fs::createUniqueDirectory(Prefix, Directory)) {
+                std::cerr << "cannot create a corpus directory: " << EC.message() << std::endl;
+                return 1;
+            }
+        } else {
+            Directory = KeepCorpus;
+            llvm::sys::path::append(Directory, "tus_" + std::to_string(tus));
+        }
+
+        int status = benchmarkScale(tus, std::string(Directory));
+        if (KeepCorpus.empty()) {
+            llvm::sys::fs::remove_directories(Directory);
+        }
+        if (status != 0) {
+            return status;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "CorpusGenerator.h"
+
+#include <llvm/Support/CommandLine.h>
+#include <iostream>
+
+static llvm::cl::opt<std::string> Output(llvm::cl::Positional, llvm::cl::desc("<output directory>"), llvm::cl::Required);
+
+static llvm::cl::opt<unsigned> TUs("tus", llvm::cl::desc("Number of translation units"), llvm::cl::init(CorpusShape().tus));
+static llvm::cl::opt<unsigned> Functions("functions", llvm::cl::desc("Functions per translation unit"),
+                                         llvm::cl::init(CorpusShape().functions));
+static llvm::cl::opt<unsigned> Globals("globals", llvm::cl::desc("File-scope variables per translation unit"),
+                                       llvm::cl::init(CorpusShape().globals));
+static llvm::cl::opt<unsigned> EnumParams("enum-params", llvm::cl::desc("Enum parameters per function"),
+                                          llvm::cl::init(CorpusShape().enumParams));
+static llvm::cl::opt<unsigned> InputSites("input-sites", llvm::cl::desc("scanf / std::cin >> statements in main"),
+                                          llvm::cl::init(CorpusShape().inputSites));
+static llvm::cl::opt<unsigned> Constructors("constructors", llvm::cl::desc("DataImage / DataArray constructions in main"),
+                                            llvm::cl::init(CorpusShape().constructors));
+static llvm::cl::opt<unsigned> HeaderClasses("header-classes", llvm::cl::desc("Class templates in framework.h"),
+                                             llvm::cl::init(CorpusShape().headerClasses));
+
+int main(int argc, const char **argv) {
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Writes a synthetic corpus for InputAnalyzer\n");
+
+    CorpusShape shape;
+    shape.tus = TUs;
+    shape.functions = Functions;
+    shape.globals = Globals;
+    shape.enumParams = EnumParams;
+    shape.inputSites = InputSites;
+    shape.constructors = Constructors;
+    shape.headerClasses = HeaderClasses;
+
+    std::vector<std::string> sources;
+    std::string error;
+    if (!CorpusGenerator(shape).generate(Output, sources, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    std::cerr << "wrote " << sources.size() << " translation units to " << Output << std::endl;
+    return 0;
+}
@@ -1,67 +1,508 @@
-#include "PreExecuteAnalyzer.h"
-#include "FunctionAnalyzer.h"
+#include "AnalysisRunner.h"
+#include "AnalysisServer.h"
+#include "BatchRunner.h"
+#include "CompactWriter.h"
+#include "NdjsonWriter.h"
+#include "Shard.h"
+#include "StdinEnvelope.h"
+#include "WatchMode.h"
 
 #include <clang/Tooling/Tooling.h>
 #include <clang/Tooling/CommonOptionsParser.h>
+#include <llvm/ADT/SmallString.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <optional>
 #include <nlohmann/json_fwd.hpp>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
-enum AnalysisMode {
-    Variables,
-    Functions,
-};
-
 static llvm::cl::opt<AnalysisMode> Mode(
     "mode",
     llvm::cl::desc("Choose analysis mode:"),
     llvm::cl::values(
         clEnumValN(Variables, "vars", "Analyze variables"),
-        clEnumValN(Functions, "funcs", "Analyze functions")
+        clEnumValN(Functions, "funcs", "Analyze functions"),
+        clEnumValN(All, "all", "Analyze variables and functions in one parse")
     ),
     llvm::cl::init(Variables)
 );
 
+static llvm::cl::SubCommand MergeCommand(
+    "merge",
+    "Combine the documents of every -shard run into the output of one run over all files"
+);
+
+static llvm::cl::list<std::string> ShardDocuments(
+    llvm::cl::Positional,
+    llvm::cl::desc("<shard document>..."),
+    llvm::cl::OneOrMore,
+    llvm::cl::sub(MergeCommand)
+);
+
+enum OutputFormat {
+    Json,
+    Ndjson,
+    Cbor,
+    Msgpack,
+};
+
+static llvm::cl::opt<OutputFormat> Format(
+    "format",
+    llvm::cl::desc("Output format:"),
+    llvm::cl::values(
+        clEnumValN(Json, "json", "One JSON document once every file is analyzed"),
+        clEnumValN(Ndjson, "ndjson", "One JSON record per line, streamed as files finish, then a summary line"),
+        clEnumValN(Cbor, "cbor", "CBOR with a string table (see CompactWriter.h for the schema)"),
+        clEnumValN(Msgpack, "msgpack", "MessagePack with a string table (see CompactWriter.h for the schema)")
+    ),
+    llvm::cl::init(Json),
+    llvm::cl::sub(llvm::cl::SubCommand::getTopLevel()),
+    llvm::cl::sub(MergeCommand)
+);
+
+static llvm::cl::opt<unsigned> Jobs(
+    "j",
+    llvm::cl::desc("Number of translation units (or server requests) to analyze in parallel (0 = all cores)"),
+    llvm::cl::init(1)
+);
+
+static llvm::cl::opt<bool> Serve(
+    "serve",
+    llvm::cl::desc("Stay resident and answer newline-delimited JSON requests on stdin"),
+    llvm::cl::init(false)
+);
+
+static llvm::cl::opt<std::string> Socket(
+    "socket",
+    llvm::cl::desc("Stay resident and answer requests on this Unix socket"),
+    llvm::cl::value_desc("path")
+);
+
+static llvm::cl::opt<std::string> Batch(
+    "batch",
+    llvm::cl::desc("Run the jobs in this NDJSON manifest in -j forked workers, printing one result line per job"),
+    llvm::cl::value_desc("manifest")
+);
+
+static llvm::cl::opt<unsigned> JobMemoryMb(
+    "job-memory-mb",
+    llvm::cl::desc("With -batch, default address-space limit per job in MiB (0 = unlimited)"),
+    llvm::cl::init(0)
+);
+
+static llvm::cl::opt<unsigned> JobCpuSeconds(
+    "job-cpu-seconds",
+    llvm::cl::desc("With -batch, default CPU time limit per job in seconds (0 = unlimited)"),
+    llvm::cl::init(0)
+);
+
+static llvm::cl::opt<double> TuTimeout(
+    "tu-timeout",
+    llvm::cl::desc("Abandon a file whose parse and analysis take longer than this many seconds (0 = unlimited). "
+                   "Checked on entering files, on macro expansions and as Sema completes declarations: one "
+                   "declaration that includes no files and expands no macros is checked only at its parts"),
+    llvm::cl::value_desc("seconds"),
+    llvm::cl::init(0)
+);
+
+static llvm::cl::opt<unsigned> TuMemoryMb(
+    "tu-memory-mb",
+    llvm::cl::desc("Abandon a file whose AST and preprocessor grow past this many MiB (0 = unlimited). "
+                   "Checked like -tu-timeout"),
+    llvm::cl::value_desc("mb"),
+    llvm::cl::init(0)
+);
+
+static llvm::cl::opt<bool> Stdin(
+    "stdin",
+    llvm::cl::desc("Read sources and compile arguments as one JSON envelope on stdin instead of from disk"),
+    llvm::cl::init(false)
+);
+
+static llvm::cl::opt<bool> Watch(
+    "watch",
+    llvm::cl::desc("Keep running and re-analyze files whose sources or includes change, printing one JSON line per update"),
+    llvm::cl::init(false)
+);
+
+static llvm::cl::opt<std::string> CacheDir(
+    "cache-dir",
+    llvm::cl::desc("Reuse per-file results stored in this directory while sources, includes and flags are unchanged"),
+    llvm::cl::value_desc("dir")
+);
+
+static llvm::cl::opt<std::string> AstCacheDir(
+    "ast-cache",
+    llvm::cl::desc("Store each file's parsed AST in this directory and load it instead of parsing while sources, includes and flags are unchanged"),
+    llvm::cl::value_desc("dir")
+);
+
+static llvm::cl::opt<bool> FastParse(
+    "fast-parse",
+    llvm::cl::desc("Skip function bodies the chosen mode never inspects and suppress diagnostics"),
+    llvm::cl::init(false)
+);
+
+static llvm::cl::opt<bool> FastParseBaseline(
+    "fast-parse-baseline",
+    llvm::cl::desc("With -fast-parse, also time a full parse of each file and report the difference"),
+    llvm::cl::init(false)
+);
+
+static llvm::cl::opt<bool> CanonicalGlobalTypes(
+    "canonical-global-types",
+    llvm::cl::desc("Match argumentVariables through typedefs, cv-qualifiers and references"),
+    llvm::cl::init(false)
+);
+
+static llvm::cl::opt<std::string> ClassifierRules(
+    "classifier-rules",
+    llvm::cl::desc("Classify function signatures with the rules in this JSON file instead of the built-in ones"),
+    llvm::cl::value_desc("file")
+);
+
+static llvm::cl::opt<bool> Prefilter(
+    "prefilter",
+    llvm::cl::desc("In vars mode, skip parsing files whose tokens show they have no input sites"),
+    llvm::cl::init(false)
+);
+
+static llvm::cl::opt<std::string> PreambleHeader(
+    "preamble",
+    llvm::cl::desc("Parse this header once into a PCH and reuse it for every file whose first directive includes it"),
+    llvm::cl::value_desc("header")
+);
+
+static llvm::cl::opt<std::string> PreamblePch(
+    "preamble-pch",
+    llvm::cl::desc("With -preamble, use this PCH built from the header instead of building one"),
+    llvm::cl::value_desc("file")
+);
+
+static llvm::cl::opt<bool> PresizeCaches(
+    "presize-caches",
+    llvm::cl::desc("Reserve the per-file variable caches from the file's declaration counts before analysis"),
+    llvm::cl::init(false)
+);
+
+static llvm::cl::list<std::string> TraverseFiles(
+    "traverse-file",
+    llvm::cl::desc("Also walk top-level declarations from this file in the variable and test analyses "
+                   "(by default only the main file's)"),
+    llvm::cl::value_desc("file"),
+    llvm::cl::CommaSeparated
+);
+
+static llvm::cl::opt<std::string> Shard(
+    "shard",
+    llvm::cl::desc("Analyze only shard i of N (0-based) of the files and print a shard document for "
+                   "'InputAnalyzer merge'; with no files given, shards every file of the compilation database"),
+    llvm::cl::value_desc("i/N")
+);
+
+static llvm::cl::opt<bool> Stats(
+    "stats",
+    llvm::cl::desc("Add a \"stats\" object with per-phase and per-file timings, peak RSS and counters to the output"),
+    llvm::cl::init(false)
+);
+
+static llvm::cl::opt<std::string> Trace(
+    "trace",
+    llvm::cl::desc("Write per-file phase timings to this file in Chrome trace-event format"),
+    llvm::cl::value_desc("file")
+);
+
 static llvm::cl::OptionCategory MyToolCategory("My tool options");
 
+static std::string encode(const json &document) {
+    if (Format == Cbor || Format == Msgpack) {
+        std::vector<std::uint8_t> bytes = Format == Cbor ? json::to_cbor(document) : json::to_msgpack(document);
+        return std::string(bytes.begin(), bytes.end());
+    }
+    return document.dump(4) + "\n";
+}
+
+// InputAnalyzer merge [-format=...] <shard document>...
+static int mergeShards(int argc, const char **argv) {
+    llvm::cl::ParseCommandLineOptions(argc, argv);
+
+    AnalysisMode mode;
+    std::vector<TUResult> results;
+    std::string error;
+    if (!readShards(ShardDocuments, mode, results, error)) {
+        std::cerr << "Cannot merge shards: " << error << std::endl;
+        return 1;
+    }
+
+    if (Format == Ndjson) {
+        NdjsonWriter writer(std::cout, mode);
+        for (const auto &tu : results) {
+            writer.write(tu);
+        }
+        writer.finish();
+        return 0;
+    }
+    std::string output = encode(Format == Json ? mergeResults(results, mode) : compactDocument(results, mode));
+    std::cout.write(output.data(), output.size());
+    std::cout.flush();
+    return 0;
+}
+
 int main(int argc, const char **argv) {
-    auto OptionsParser = clang::tooling::CommonOptionsParser::create(argc, argv, MyToolCategory);
+    // Parsed before CommonOptionsParser, which would try to load a
+    // compilation database for the shard documents.
+    if (argc > 1 && llvm::StringRef(argv[1]) == "merge") {
+        return mergeShards(argc, argv);
+    }
+
+    statsOrigin();
+    unsigned mainThread = statsThreadId();
+
+    auto OptionsParser = clang::tooling::CommonOptionsParser::create(argc, argv, MyToolCategory, llvm::cl::ZeroOrMore);
     if (!OptionsParser) {
         std::cerr << "Error parsing options" << std::endl;
         return 1;
     }
 
-    clang::tooling::ClangTool Tool(OptionsParser->getCompilations(), OptionsParser->getSourcePathList());
+    std::unique_ptr<ResultCache> cache;
+    if (!CacheDir.empty()) {
+        cache = std::make_unique<ResultCache>(CacheDir);
+    }
+    std::unique_ptr<ResultCache> astCache;
+    if (!AstCacheDir.empty()) {
+        astCache = std::make_unique<ResultCache>(AstCacheDir);
+    }
+
+    std::unique_ptr<SignatureClassifier> classifier;
+    if (!ClassifierRules.empty()) {
+        std::string error;
+        classifier = SignatureClassifier::fromFile(ClassifierRules, error);
+        if (!classifier) {
+            std::cerr << "Invalid classifier rules: " << error << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<Preamble> preamble;
+    if (!PreambleHeader.empty()) {
+        preamble = std::make_unique<Preamble>(PreambleHeader, PreamblePch);
+    } else if (!PreamblePch.empty()) {
+        std::cerr << "-preamble-pch requires -preamble" << std::endl;
+        return 1;
+    }
+
+    AnalysisOptions options;
+    options.mode = Mode;
+    options.cache = cache.get();
+    options.astCache = astCache.get();
+    options.fastParse = FastParse;
+    options.measureBaseline = FastParseBaseline;
+    options.canonicalGlobalTypes = CanonicalGlobalTypes;
+    options.classifier = classifier.get();
+    options.presizeCaches = PresizeCaches;
+    for (const auto &file : TraverseFiles) {
+        llvm::SmallString<256> Path(file);
+        llvm::sys::fs::make_absolute(Path);
+        llvm::sys::path::remove_dots(Path, true);
+        options.traversalFiles.push_back(std::string(Path));
+    }
+    options.prefilter = Prefilter;
+    options.preamble = preamble.get();
+    options.collectStats = Stats || !Trace.empty();
+    options.budget = BudgetLimits{TuTimeout, TuMemoryMb};
+
+    std::optional<ShardSpec> shard;
+    if (!Shard.empty()) {
+        std::string error;
+        shard = ShardSpec::parse(Shard, error);
+        if (!shard) {
+            std::cerr << "Invalid -shard: " << error << std::endl;
+            return 1;
+        }
+        if (Watch || Serve || !Socket.empty() || !Batch.empty()) {
+            std::cerr << "-shard cannot be combined with -watch, -serve, -socket or -batch" << std::endl;
+            return 1;
+        }
+        if (Format != Json) {
+            std::cerr << "-shard always writes a JSON shard document; pass -format to 'merge' instead" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!Batch.empty()) {
+        if (Stdin || Watch || Serve || !Socket.empty()) {
+            std::cerr << "-batch cannot be combined with -stdin, -watch, -serve or -socket" << std::endl;
+            return 1;
+        }
+        AnalysisServer handler(OptionsParser->getCompilations(), 1, options);
+        return BatchRunner(handler, Jobs, BatchLimits{JobMemoryMb, JobCpuSeconds}).run(Batch);
+    }
+
+    if (Serve || !Socket.empty()) {
+        if (Stdin) {
+            std::cerr << "-stdin cannot be combined with -serve or -socket" << std::endl;
+            return 1;
+        }
+        AnalysisServer server(OptionsParser->getCompilations(), Jobs, options);
+        return Socket.empty() ? server.serveStdio() : server.serveSocket(Socket);
+    }
+
+    const tooling::CompilationDatabase *db = &OptionsParser->getCompilations();
+    std::vector<std::string> sources = OptionsParser->getSourcePathList();
+
+    StdinEnvelope envelope;
+    if (Stdin) {
+        if (Watch) {
+            std::cerr << "-stdin cannot be combined with -watch" << std::endl;
+            return 1;
+        }
+        std::string error;
+        if (!envelope.read(std::cin, error)) {
+            std::cerr << "Invalid stdin envelope: " << error << std::endl;
+            return 1;
+        }
+        db = &envelope.compilations();
+        sources = envelope.sources();
+        options.virtualFiles = &envelope.files();
+    }
+
+    // The full list is what the shard document describes; `sources` becomes
+    // this shard's part of it.
+    std::vector<std::string> allSources;
+    std::vector<size_t> shardIndices;
+    if (shard) {
+        if (sources.empty()) {
+            sources = db->getAllFiles();
+            std::sort(sources.begin(), sources.end());
+        }
+        allSources = std::move(sources);
+        sources.clear();
+        for (size_t i = 0; i < allSources.size(); ++i) {
+            if (shard->contains(allSources[i])) {
+                shardIndices.push_back(i);
+                sources.push_back(allSources[i]);
+            }
+        }
+    }
+
+    if (sources.empty() && !shard) {
+        std::cerr << "No source files given" << std::endl;
+        return 1;
+    }
 
-    json result;
+    if (Watch) {
+        WatchSession session(*db, sources, options, Jobs);
+        return session.run();
+    }
 
-    if (Mode == Variables) {
-        Data variables;
-        std::vector<std::pair<std::string, std::string>> strings;
-        bool canTest;
-        Factory f(variables, strings, canTest);
-        Tool.run(&f);
+    unsigned skipped = 0;
+    size_t prefiltered = 0;
+    double analysisMs = 0;
+    double baselineMs = 0;
+    std::vector<std::pair<std::string, std::string>> preambleUse;
+    std::vector<std::pair<std::string, std::string>> abandoned;
+    std::vector<TUStats> tuStats;
+    std::vector<PhaseTime> processPhases;
+    auto tally = [&](TUResult &tu) {
+        skipped += tu.skippedBodies;
+        prefiltered += tu.prefiltered;
+        analysisMs += tu.analysisMs;
+        baselineMs += tu.baselineMs;
+        if (preamble && !tu.preamble.empty()) {
+            preambleUse.push_back({tu.file, tu.preamble});
+        }
+        if (!tu.status.empty()) {
+            abandoned.push_back({tu.file, tu.status});
+        }
+        if (options.collectStats) {
+            tuStats.push_back(std::move(tu.stats));
+        }
+    };
+    auto stats = [&] {
+        return statsDocument(tuStats, processPhases,
+                             CacheCounts{cache != nullptr, cache ? cache->hits() : 0, cache ? cache->misses() : 0});
+    };
 
-        result["strings"] = json::array();
-        for (const auto& [type, filename] : strings) {
-            result["strings"].push_back({
-                {"type", type},
-                {"filename", filename}
-            });
+    if (Format == Ndjson) {
+        // Records are serialized while analysis runs, so "analysis" includes it.
+        NdjsonWriter writer(std::cout, Mode);
+        PhaseClock analysisClock(/*processCpu=*/true);
+        analyzeAll(*db, sources, options, Jobs,
+                   [&](size_t, TUResult &tu) {
+                       tally(tu);
+                       writer.write(tu);
+                   });
+        processPhases.push_back(analysisClock.stop("analysis"));
+        writer.finish();
+        if (Stats) {
+            writer.writeStats(stats());
         }
-        result["can_test"] = canTest;
-        result["variables"] = variables;
     } else {
-        FunctionData functions;
-        FunctionFactory f(functions);
-        Tool.run(&f);
-        result = {{"functions", functions}};
+        PhaseClock analysisClock(/*processCpu=*/true);
+        auto results = analyzeAll(*db, sources, options, Jobs);
+        processPhases.push_back(analysisClock.stop("analysis"));
+        for (auto &tu : results) {
+            tally(tu);
+        }
+
+        PhaseClock serializeClock(/*processCpu=*/true);
+        json document = shard ? shardDocument(*shard, Mode, allSources, shardIndices, results)
+                        : Format == Json ? mergeResults(results, Mode) : compactDocument(results, Mode);
+        std::string output = encode(document);
+        processPhases.push_back(serializeClock.stop("serialize"));
+
+        // The timed encoding above is of the plain document; adding the
+        // stats means encoding it once more.
+        if (Stats) {
+            document["stats"] = stats();
+            output = encode(document);
+        }
+        std::cout.write(output.data(), output.size());
+        std::cout.flush();
+    }
+
+    if (!Trace.empty()) {
+        std::ofstream trace(Trace);
+        trace << traceDocument(tuStats, processPhases, mainThread).dump() << std::endl;
+        if (!trace) {
+            std::cerr << "Cannot write trace file " << Trace << std::endl;
+            return 1;
+        }
+    }
+
+    if (cache) {
+        std::cerr << "cache: " << cache->hits() << " hits, " << cache->misses() << " misses" << std::endl;
+    }
+    if (astCache) {
+        std::cerr << "ast cache: " << astCache->hits() << " hits, " << astCache->misses() << " misses" << std::endl;
     }
 
-    std::cout << result.dump(4) << std::endl;
+    if (Prefilter) {
+        std::cerr << "prefilter: " << prefiltered << " of " << sources.size() << " files skipped without parsing"
+                  << std::endl;
+    }
+
+    for (const auto &[file, status] : abandoned) {
+        std::cerr << "abandoned: " << file << ": " << status << std::endl;
+    }
+
+    for (const auto &[file, use] : preambleUse) {
+        std::cerr << "preamble: " << file << ": " << use << std::endl;
+    }
+
+    if (FastParse) {
+        std::cerr << "fast parse: " << skipped << " function bodies skipped, " << analysisMs << " ms";
+        if (FastParseBaseline) {
+            std::cerr << " vs " << baselineMs << " ms full parse (saved " << baselineMs - analysisMs << " ms)";
+        }
+        std::cerr << std::endl;
+    }
 
     return 0;
 }
\ No newline at end of file
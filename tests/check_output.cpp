@@ -0,0 +1,239 @@
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// Runs InputAnalyzer on one set of arguments (everything after "--") and
+// checks its output against a golden document, its timings and peak RSS
+// against a baseline, or both:
+//
+//   InputAnalyzerCheck -tool=<InputAnalyzer> -golden=<json> -- -mode=vars main.cpp -- -std=c++17
+//   InputAnalyzerCheck -tool=<InputAnalyzer> -baseline=<json> -repeat=5 -- -stats -p corpus tu_0.cpp ...
+//
+// With INPUT_ANALYZER_UPDATE_GOLDEN=1 the output is written as the new
+// golden document, with INPUT_ANALYZER_UPDATE_BASELINES=1 the measurements
+// as the new baseline. A missing baseline is recorded and the check exits
+// with SkipCode, which ctest reports as skipped rather than passed.
+
+static llvm::cl::opt<std::string> Tool("tool", llvm::cl::desc("InputAnalyzer executable"), llvm::cl::Required);
+static llvm::cl::opt<std::string> Golden("golden", llvm::cl::desc("Expected output, without \"stats\""),
+                                         llvm::cl::value_desc("json"));
+static llvm::cl::opt<std::string> Baseline("baseline", llvm::cl::desc("Recorded timings and peak RSS"),
+                                           llvm::cl::value_desc("json"));
+static llvm::cl::opt<double> Tolerance("tolerance",
+                                       llvm::cl::desc("Allowed growth over the baseline, as a fraction (default 0.15)"),
+                                       llvm::cl::init(0.15));
+static llvm::cl::opt<double> SlackMs("slack-ms",
+                                     llvm::cl::desc("Timing growth below this many milliseconds always passes"),
+                                     llvm::cl::init(1.0));
+static llvm::cl::opt<unsigned> Repeat("repeat", llvm::cl::desc("Runs to measure; the lowest value counts"),
+                                      llvm::cl::init(3));
+
+// What a baseline holds: CPU time rather than wall time, so that other load
+// on the machine moves the numbers as little as possible.
+// Empty when the stats lack the value: a phase that was never timed must
+// not pass as one that took no time.
+struct Metric {
+    const char *name;
+    bool timing;
+    std::optional<double> (*read)(const json &stats);
+};
+
+static std::optional<double> number(const json &value) {
+    if (!value.is_number()) {
+        return std::nullopt;
+    }
+    return value.get<double>();
+}
+
+static std::optional<double> phaseCpuMs(const json &stats, const char *phase) {
+    json::json_pointer path("/totals/phases/" + std::string(phase) + "/cpu_ms");
+    return stats.contains(path) ? number(stats.at(path)) : std::nullopt;
+}
+
+static const Metric Metrics[] = {
+    {"parse_cpu_ms", true, [](const json &stats) { return phaseCpuMs(stats, "parse"); }},
+    {"traverse_cpu_ms", true, [](const json &stats) { return phaseCpuMs(stats, "traverse"); }},
+    {"peak_rss_kb", false,
+     [](const json &stats) { return stats.contains("peak_rss_kb") ? number(stats["peak_rss_kb"]) : std::nullopt; }},
+};
+
+// The exit code of a check that had no baseline to compare with; the
+// tests set it as their SKIP_RETURN_CODE.
+static constexpr int SkipCode = 77;
+
+static bool updating(const char *variable) {
+    const char *value = std::getenv(variable);
+    return value && llvm::StringRef(value) != "" && llvm::StringRef(value) != "0";
+}
+
+static bool readJson(const std::string &path, json &value) {
+    auto Buffer = llvm::MemoryBuffer::getFile(path);
+    if (!Buffer) {
+        return false;
+    }
+    value = json::parse((*Buffer)->getBuffer().begin(), (*Buffer)->getBuffer().end(), nullptr, false);
+    return !value.is_discarded();
+}
+
+static bool writeJson(const std::string &path, const json &value) {
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path));
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(path, EC);
+    if (EC) {
+        std::cerr << "Cannot write " << path << ": " << EC.message() << std::endl;
+        return false;
+    }
+    OS << value.dump(4) << "\n";
+    return true;
+}
+
+static bool run(const std::vector<llvm::StringRef> &args, json &output) {
+    llvm::SmallString<256> OutputPath;
+    if (llvm::sys::fs::createTemporaryFile("input-analyzer-check", "json", OutputPath)) {
+        std::cerr << "Cannot create a temporary file" << std::endl;
+        return false;
+    }
+
+    std::optional<llvm::StringRef> Redirects[] = {std::nullopt, llvm::StringRef(OutputPath), std::nullopt};
+    std::string error;
+    int status = llvm::sys::ExecuteAndWait(Tool, args, std::nullopt, Redirects, 0, 0, &error);
+    bool parsed = status == 0 && readJson(std::string(OutputPath), output);
+    llvm::sys::fs::remove(OutputPath);
+
+    if (status != 0) {
+        std::cerr << Tool << " exited with " << status << (error.empty() ? "" : ": " + error) << std::endl;
+        return false;
+    }
+    if (!parsed) {
+        std::cerr << Tool << " did not write a json document" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool checkGolden(const json &output) {
+    if (updating("INPUT_ANALYZER_UPDATE_GOLDEN")) {
+        std::cerr << "updated " << Golden << std::endl;
+        return writeJson(Golden, output);
+    }
+
+    json expected;
+    if (!readJson(Golden, expected)) {
+        std::cerr << "Cannot read " << Golden << std::endl;
+        return false;
+    }
+    if (output != expected) {
+        std::cerr << "output differs from " << Golden << " (json patch from golden to output):\n"
+                  << json::diff(expected, output).dump(4) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static int checkBaseline(const json &measured) {
+    json recorded;
+    bool update = updating("INPUT_ANALYZER_UPDATE_BASELINES");
+    if (update || !readJson(Baseline, recorded)) {
+        std::cerr << "recorded " << Baseline << ": " << measured.dump() << std::endl;
+        if (!writeJson(Baseline, measured)) {
+            return 1;
+        }
+        if (!update) {
+            std::cerr << "no baseline to compare with yet: skipped" << std::endl;
+            return SkipCode;
+        }
+        return 0;
+    }
+
+    bool ok = true;
+    for (const auto &metric : Metrics) {
+        if (!recorded.contains(metric.name)) {
+            continue;
+        }
+        double before = recorded.at(metric.name).get<double>();
+        double now = measured.at(metric.name).get<double>();
+        double limit = before * (1 + Tolerance);
+        if (metric.timing) {
+            limit = std::max(limit, before + SlackMs);
+        }
+        bool within = now <= limit;
+        std::cerr << (within ? "ok   " : "FAIL ") << metric.name << ": " << now << " (baseline " << before
+                  << ", limit " << limit << ")" << std::endl;
+        ok = ok && within;
+    }
+    if (!ok) {
+        std::cerr << "Rerun with INPUT_ANALYZER_UPDATE_BASELINES=1 if the change is intended" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
+
+int main(int argc, const char **argv) {
+    int split = argc;
+    for (int i = 1; i < argc; ++i) {
+        if (llvm::StringRef(argv[i]) == "--") {
+            split = i;
+            break;
+        }
+    }
+    llvm::cl::ParseCommandLineOptions(split, argv, "Checks InputAnalyzer output and performance\n");
+    if (Golden.empty() && Baseline.empty()) {
+        std::cerr << "Nothing to check: give -golden, -baseline or both" << std::endl;
+        return 1;
+    }
+
+    std::vector<llvm::StringRef> args{Tool};
+    for (int i = split + 1; i < argc; ++i) {
+        args.push_back(argv[i]);
+    }
+
+    json measured = json::object();
+    for (const auto &metric : Metrics) {
+        measured[metric.name] = std::numeric_limits<double>::infinity();
+    }
+
+    unsigned runs = Baseline.empty() ? 1 : std::max(1u, unsigned(Repeat));
+    for (unsigned i = 0; i < runs; ++i) {
+        json output;
+        if (!run(args, output)) {
+            return 1;
+        }
+        json stats = output.contains("stats") ? output["stats"] : json();
+        output.erase("stats");
+
+        if (i == 0 && !Golden.empty() && !checkGolden(output)) {
+            return 1;
+        }
+        if (Baseline.empty()) {
+            continue;
+        }
+        if (stats.is_null()) {
+            std::cerr << "A -baseline check needs -stats among the tool's arguments" << std::endl;
+            return 1;
+        }
+        for (const auto &metric : Metrics) {
+            std::optional<double> value = metric.read(stats);
+            if (!value) {
+                std::cerr << "The tool's stats have no " << metric.name << std::endl;
+                return 1;
+            }
+            measured[metric.name] = std::min(measured[metric.name].get<double>(), *value);
+        }
+    }
+
+    return Baseline.empty() ? 0 : checkBaseline(measured);
+}
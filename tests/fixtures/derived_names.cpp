@@ -0,0 +1,8 @@
+struct MyDataImage {
+    MyDataImage(const char *path);
+};
+
+int main() {
+    MyDataImage image("images/dog.png");
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef FILL_H
+#define FILL_H
+
+#include "framework.h"
+
+inline void fill(int *values, size_t count, int seed) {
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = seed;
+    }
+}
+
+#endif
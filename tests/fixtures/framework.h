@@ -0,0 +1,39 @@
+// Stand-ins for the framework and library declarations the analyzer looks
+// for. The fixtures include nothing else, so their output and timings do
+// not depend on the installed standard library.
+#pragma once
+
+typedef decltype(sizeof(0)) size_t;
+
+extern "C" int scanf(const char *format, ...);
+
+namespace std {
+class istream {
+public:
+    istream &operator>>(int &value);
+    istream &operator>>(long long &value);
+    istream &operator>>(double &value);
+    istream &operator>>(char *text);
+};
+extern istream cin;
+} // namespace std
+
+struct RGBImage { unsigned char r, g, b; };
+struct VideoFrame { int width, height; };
+struct AudioFrame { int rate; };
+struct AudioBuffer { float *samples; size_t size; };
+enum Mode { Fast, Balanced, Precise };
+enum class Channel { Left, Right, Both };
+
+class TestOptions { public: int repetitions; };
+class FunctionManager {};
+class DataManager {};
+class TestFunctions {
+public:
+    TestFunctions();
+    TestFunctions(FunctionManager &functions, DataManager &data, TestOptions &options);
+    void run();
+};
+class DataImage { public: explicit DataImage(const char *path); };
+class DataArray { public: explicit DataArray(const char *path); };
+class DataText { public: explicit DataText(const char *path); };
@@ -0,0 +1,6 @@
+#include <stdio.h>
+
+int main() {
+    Picture photo("images/cat.png");
+    return 0;
+}
@@ -0,0 +1,6 @@
+// Not the C library's header: a project header that -I puts under its
+// name.
+#pragma once
+
+class DataImage { public: explicit DataImage(const char *path); };
+typedef DataImage Picture;
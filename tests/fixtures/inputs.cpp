@@ -0,0 +1,19 @@
+#include "framework.h"
+
+int limit;
+
+void readLimit() {
+    scanf("%d", &limit);
+}
+
+int main() {
+    int count;
+    double ratio;
+    char name[32];
+    long long total;
+    scanf("%d %lf", &count, &ratio);
+    std::cin >> name;
+    std::cin >> total >> count;
+    readLimit();
+    return 0;
+}
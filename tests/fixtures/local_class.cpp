@@ -0,0 +1,8 @@
+int scale(int value) {
+    struct Doubler {
+        int apply(int x) {
+            return x * 2;
+        }
+    };
+    return Doubler().apply(value);
+}
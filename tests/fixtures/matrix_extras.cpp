@@ -0,0 +1,12 @@
+#include "framework.h"
+
+struct Context { int depth; };
+struct Grid { int cells; };
+
+size_t defaultCols = 4;
+
+void blur(Context **grid, size_t rows, size_t cols) {
+}
+
+void shade(Grid **grid, size_t rows, size_t cols) {
+}
@@ -0,0 +1,12 @@
+#include "framework.h"
+
+namespace first { struct Config { int level; }; }
+namespace second { struct Config { int level; }; }
+
+using first::Config;
+Config settings;
+
+namespace second {
+void apply(int *values, size_t count, Config config) {
+}
+}
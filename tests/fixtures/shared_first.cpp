@@ -0,0 +1,9 @@
+#include "fill.h"
+
+int firstSeed = 1;
+
+int main() {
+    int values[4];
+    fill(values, 4, firstSeed);
+    return values[0];
+}
@@ -0,0 +1,7 @@
+#include "fill.h"
+
+int secondSeed = 2;
+
+void reset(int *values, size_t count) {
+    fill(values, count, secondSeed);
+}
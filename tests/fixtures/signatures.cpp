@@ -0,0 +1,70 @@
+#include "framework.h"
+
+int threshold = 10;
+int retries = 3;
+size_t capacity = 64;
+double scale = 1.5;
+Mode defaultMode = Fast;
+
+void sort(int *data, size_t size) {
+    for (size_t i = 1; i < size; ++i) {
+        for (size_t j = i; j > 0 && data[j - 1] > data[j]; --j) {
+            int swapped = data[j];
+            data[j] = data[j - 1];
+            data[j - 1] = swapped;
+        }
+    }
+}
+
+void sortBy(int *data, size_t size, Mode mode) {
+    if (mode != Fast) {
+        sort(data, size);
+    }
+}
+
+size_t countWords(char *text, size_t size) {
+    size_t words = 0;
+    for (size_t i = 0; i < size; ++i) {
+        words += text[i] == ' ';
+    }
+    return words;
+}
+
+double trace(double **matrix, size_t rows, size_t cols) {
+    double sum = 0;
+    for (size_t i = 0; i < rows && i < cols; ++i) {
+        sum += matrix[i][i];
+    }
+    return sum;
+}
+
+void invert(RGBImage **image, size_t width, size_t height) {
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            image[y][x].r = 255 - image[y][x].r;
+        }
+    }
+}
+
+void gain(float *samples, size_t size, int rate, int channels, Channel channel) {
+    for (size_t i = 0; i < size; ++i) {
+        samples[i] *= 0.5f * channels / rate;
+    }
+}
+
+void mix(AudioBuffer buffer, size_t size, int rate, int channels) {
+    buffer.size = size * rate * channels;
+}
+
+void mux(VideoFrame video, AudioFrame audio, size_t width, size_t height, size_t stride, size_t frames, int fps,
+         int quality, Mode mode) {
+    video.width = static_cast<int>(width * height / (stride + frames + 1)) + fps * quality + audio.rate + mode;
+}
+
+int helper(int a, double b) {
+    return a + static_cast<int>(b);
+}
+
+int main() {
+    return helper(threshold, scale);
+}
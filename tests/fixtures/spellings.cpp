@@ -0,0 +1,13 @@
+#include "framework.h"
+
+typedef size_t Length;
+typedef AudioBuffer Samples;
+
+void fill(int *values, Length count) {
+}
+
+void blend(const int *pixels, size_t count) {
+}
+
+void play(Samples samples, size_t size, int rate, int channels) {
+}
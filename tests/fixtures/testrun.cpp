@@ -0,0 +1,15 @@
+#include "framework.h"
+
+int main() {
+    TestOptions options;
+    FunctionManager functions;
+    DataManager data;
+    TestFunctions tests(functions, data, options);
+
+    const char *samples = "data/samples.txt";
+    DataImage image("images/cat.png");
+    DataArray numbers("data/numbers.txt");
+    DataText text(samples);
+    tests.run();
+    return 0;
+}
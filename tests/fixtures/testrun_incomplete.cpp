@@ -0,0 +1,10 @@
+#include "framework.h"
+
+// No DataManager in main, so run() does not make the submission testable.
+int main() {
+    TestOptions options;
+    FunctionManager functions;
+    TestFunctions tests;
+    tests.run();
+    return 0;
+}